@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #endif
 
+#include "dsp/simd/iq8_vec_convert.h"
 #include "utility/getopt/getopt.h"
 
 // Source: http://soundfile.sapp.org/doc/WaveFormat/
@@ -178,9 +179,7 @@ int main(int argc, char** argv) {
         if (!is_u8) {
             auto x = reinterpret_cast<int8_t*>(rd_buf.data());
             auto y = reinterpret_cast<uint8_t*>(rd_buf.data());
-            for (size_t i = 0; i < nb_read; i++) {
-                y[i] = (uint8_t)((int)x[i] + 127);
-            }
+            s8_to_u8_vec_convert_auto(x, y, (int)nb_read);
         }
 
         fwrite(rd_buf.data(), sizeof(uint8_t), nb_read, fp_out);
@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #endif
 
+#include "dsp/simd/iq8_vec_convert.h"
 #include "utility/getopt/getopt.h"
 
 void usage() {
@@ -91,11 +92,7 @@ int main(int argc, char** argv) {
         }
         nb_data_bytes += nb_read;
 
-        for (size_t i = 0; i < nb_read; i++) {
-            auto& v0 = rd_buf[i];
-            auto& v1 = wr_buf[i];
-            v1 = (uint8_t)((int)v0 + 127);
-        }
+        s8_to_u8_vec_convert_auto(rd_buf.data(), wr_buf.data(), (int)nb_read);
 
         fwrite(wr_buf.data(), sizeof(uint8_t), nb_read, fp_out);
     }
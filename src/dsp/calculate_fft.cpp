@@ -2,51 +2,414 @@
 
 #define _USE_MATH_DEFINES
 #include <cmath>
-#include <fftw3.h>
+#include <assert.h>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <algorithm>
 #include <unordered_map>
+#include "fft_radix4.h"
+#include "simd/cpu_features.h"
+#include "utility/aligned_vector.h"
+
+#if defined(GPS_USE_FFTW)
+#include <fftw3.h>
+#endif
+
+// Executes block_size transforms on total_blocks contiguous blocks
+// NOTE: Kernels are read only after creation so they can be executed from multiple threads
+class FFT_Kernel
+{
+public:
+    virtual ~FFT_Kernel() = default;
+    // x and y are the same array for inplace transforms
+    virtual void Execute(const std::complex<float>* x, std::complex<float>* y, const size_t total_blocks) const = 0;
+};
 
-struct Key 
-{ 
-    size_t block_size; 
-    bool is_inverse; 
+struct Key
+{
+    size_t block_size;
+    bool is_inverse;
+    bool is_inplace;
+    bool is_batch;
+    FFT_Backend backend;
     bool operator==(const Key& other) const {
-        return 
+        return
             (block_size == other.block_size) &&
-            (is_inverse == other.is_inverse);
+            (is_inverse == other.is_inverse) &&
+            (is_inplace == other.is_inplace) &&
+            (is_batch == other.is_batch) &&
+            (backend == other.backend);
     }
 };
 
-struct KeyHasher 
+struct KeyHasher
 {
     std::size_t operator()(const Key& k) const {
         const size_t shift = sizeof(size_t)*8 - 1;
-        return (k.block_size | ((size_t)k.is_inverse << shift));
+        const size_t hash = k.block_size ^ ((size_t)k.backend << (sizeof(size_t)*4));
+        return
+            hash |
+            ((size_t)k.is_inverse << shift) |
+            ((size_t)k.is_inplace << (shift-1)) |
+            ((size_t)k.is_batch << (shift-2));
     }
 };
 
-static auto fft_plans = std::unordered_map<Key, fftwf_plan, KeyHasher>();
-static auto mutex_fft_plans = std::mutex();
+// Kernels and fftw plans are cached for the lifetime of the program
+// NOTE: The fftw planner isn't thread safe so everything here is accessed under the same lock
+static auto fft_kernels = std::unordered_map<Key, std::unique_ptr<FFT_Kernel>, KeyHasher>();
+static auto fft_auto_backends = std::unordered_map<size_t, FFT_Backend>();
+static auto mutex_fft = std::mutex();
+static FFT_Backend fft_backend = FFT_Backend::AUTO;
+
+#if defined(GPS_USE_FFTW)
+struct FFTW_Key
+{
+    size_t block_size;
+    size_t total_blocks;
+    bool is_inverse;
+    bool is_inplace;
+    bool is_aligned;
+    bool operator==(const FFTW_Key& other) const {
+        return
+            (block_size == other.block_size) &&
+            (total_blocks == other.total_blocks) &&
+            (is_inverse == other.is_inverse) &&
+            (is_inplace == other.is_inplace) &&
+            (is_aligned == other.is_aligned);
+    }
+};
+
+struct FFTW_KeyHasher
+{
+    std::size_t operator()(const FFTW_Key& k) const {
+        const size_t shift = sizeof(size_t)*8 - 1;
+        const size_t hash = k.block_size ^ (k.total_blocks << (sizeof(size_t)*4));
+        return
+            hash |
+            ((size_t)k.is_inverse << shift) |
+            ((size_t)k.is_inplace << (shift-1)) |
+            ((size_t)k.is_aligned << (shift-2));
+    }
+};
+
+// Largest number of transforms in a single batched plan
+constexpr size_t MAX_BATCH_BLOCKS = 16;
+
+static auto fftw_plans = std::unordered_map<FFTW_Key, fftwf_plan, FFTW_KeyHasher>();
+static unsigned fftw_plan_flags = FFTW_ESTIMATE;
+
+// fftw assumes that arrays passed to an aligned plan have the same simd alignment as the ones it was planned with
+static bool IsAligned(const void* x) {
+    return fftwf_alignment_of((float*)x) == 0;
+}
+
+static fftwf_plan CreatePlan(const FFTW_Key& key) {
+    auto type = key.is_inverse ? FFTW_BACKWARD : FFTW_FORWARD;
+    // Unaligned plans are a fallback for arbitrary buffers so they aren't worth measuring
+    const unsigned flags = key.is_aligned ? fftw_plan_flags : (FFTW_ESTIMATE | FFTW_UNALIGNED);
+    // Measuring overwrites the arrays so plan with scratch buffers instead of the caller's
+    // NOTE: fftwf_malloc gives the simd alignment that aligned plans are restricted to
+    const size_t N = key.block_size*key.total_blocks;
+    auto* x = (fftwf_complex*)fftwf_malloc(N*sizeof(fftwf_complex));
+    auto* y = key.is_inplace ? x : (fftwf_complex*)fftwf_malloc(N*sizeof(fftwf_complex));
+
+    fftwf_plan plan;
+    if (key.total_blocks == 1) {
+        plan = fftwf_plan_dft_1d((int)key.block_size, x, y, type, flags);
+    } else {
+        // Use the advanced interface so fftw can vectorise across contiguous transforms
+        const int n = (int)key.block_size;
+        plan = fftwf_plan_many_dft(
+            1, &n, (int)key.total_blocks,
+            x, NULL, 1, n,
+            y, NULL, 1, n,
+            type, flags);
+    }
+
+    if (y != x) {
+        fftwf_free(y);
+    }
+    fftwf_free(x);
+    return plan;
+}
 
-static fftwf_plan GetPlan(const size_t block_size, const bool is_inverse) {
-    auto lock = std::scoped_lock(mutex_fft_plans);
-    auto key = Key{ block_size, is_inverse };
-    auto res = fft_plans.find(key);
-    if (res == fft_plans.end()) {
-        auto type = is_inverse ? FFTW_BACKWARD : FFTW_FORWARD;
-        auto plan = fftwf_plan_dft_1d((int)block_size, NULL, NULL, type, FFTW_ESTIMATE);
-        res = fft_plans.insert({ key, plan }).first;
+static fftwf_plan GetPlan(
+    const size_t block_size, const bool is_inverse, const bool is_inplace, const bool is_aligned,
+    const size_t total_blocks=1)
+{
+    auto key = FFTW_Key{ block_size, total_blocks, is_inverse, is_inplace, is_aligned };
+    auto res = fftw_plans.find(key);
+    if (res == fftw_plans.end()) {
+        auto plan = CreatePlan(key);
+        res = fftw_plans.insert({ key, plan }).first;
     }
     return res->second;
 }
 
+// Batches are executed in chunks so the number of distinct plans that need measuring is bounded
+class FFTW_Kernel: public FFT_Kernel
+{
+private:
+    size_t block_size;
+    // [total_blocks-1]
+    std::vector<fftwf_plan> plans;
+    std::vector<fftwf_plan> unaligned_plans;
+public:
+    FFTW_Kernel(const size_t _block_size, const bool is_inverse, const bool is_inplace, const bool is_batch)
+    : block_size(_block_size)
+    {
+        const size_t max_blocks = is_batch ? MAX_BATCH_BLOCKS : 1;
+        plans.reserve(max_blocks);
+        unaligned_plans.reserve(max_blocks);
+        for (size_t i = 1; i <= max_blocks; i++) {
+            plans.push_back(GetPlan(block_size, is_inverse, is_inplace, true, i));
+            unaligned_plans.push_back(GetPlan(block_size, is_inverse, is_inplace, false, i));
+        }
+    }
+    void Execute(const std::complex<float>* x, std::complex<float>* y, const size_t total_blocks) const override {
+        const size_t max_blocks = plans.size();
+        for (size_t i = 0; i < total_blocks; i+=max_blocks) {
+            const size_t total_chunk_blocks = std::min(max_blocks, total_blocks-i);
+            auto* x_chunk = (fftwf_complex*)&x[i*block_size];
+            auto* y_chunk = (fftwf_complex*)&y[i*block_size];
+            // NOTE: Chunks of an odd block size alternate in alignment
+            const bool is_aligned = IsAligned(x_chunk) && IsAligned(y_chunk);
+            auto plan = is_aligned ? plans[total_chunk_blocks-1] : unaligned_plans[total_chunk_blocks-1];
+            fftwf_execute_dft(plan, x_chunk, y_chunk);
+        }
+    }
+};
+#endif
+
+// Power of two block sizes use radix-4 directly and everything else goes through bluestein
+template <typename T>
+class Radix4_Kernel: public FFT_Kernel
+{
+private:
+    T fft;
+    size_t block_size;
+    bool is_simd;
+public:
+    Radix4_Kernel(const size_t _block_size, const bool is_inverse, const bool _is_simd)
+    : fft(_block_size, is_inverse), block_size(_block_size), is_simd(_is_simd) {}
+    void Execute(const std::complex<float>* x, std::complex<float>* y, const size_t total_blocks) const override {
+        // Scratch space is per thread since kernels are shared between threads
+        static thread_local AlignedVector<std::complex<float>> scratch;
+        const size_t scratch_size = fft.GetScratchSize();
+        if (scratch.size() < scratch_size) {
+            scratch = AlignedVector<std::complex<float>>(scratch_size);
+        }
+        for (size_t i = 0; i < total_blocks; i++) {
+            fft.Execute(&x[i*block_size], &y[i*block_size], scratch.data(), is_simd);
+        }
+    }
+};
+
+static std::unique_ptr<FFT_Kernel> CreateKernel(const Key& key) {
+    const bool is_power_of_two = fft_is_power_of_two(key.block_size);
+    switch (key.backend) {
+    #if defined(GPS_USE_FFTW)
+    case FFT_Backend::FFTW:
+        return std::make_unique<FFTW_Kernel>(key.block_size, key.is_inverse, key.is_inplace, key.is_batch);
+    #endif
+    case FFT_Backend::AVX2:
+    case FFT_Backend::PORTABLE:
+    default:
+        {
+            const bool is_simd = (key.backend == FFT_Backend::AVX2);
+            if (is_power_of_two) {
+                return std::make_unique<Radix4_Kernel<FFT_Radix4>>(key.block_size, key.is_inverse, is_simd);
+            }
+            return std::make_unique<Radix4_Kernel<FFT_Bluestein>>(key.block_size, key.is_inverse, is_simd);
+        }
+    }
+}
+
+static const FFT_Kernel* GetCachedKernel(const Key& key) {
+    auto res = fft_kernels.find(key);
+    if (res == fft_kernels.end()) {
+        res = fft_kernels.insert({ key, CreateKernel(key) }).first;
+    }
+    return res->second.get();
+}
+
+// Time a forward transform of each available backend on aligned buffers
+// NOTE: Inverse and batched transforms of the same block size are assumed to rank the same
+static FFT_Backend BenchmarkBackends(const size_t block_size) {
+    constexpr FFT_Backend BACKENDS[] = { FFT_Backend::FFTW, FFT_Backend::AVX2, FFT_Backend::PORTABLE };
+    // Roughly a million samples per measurement and the best of a few measurements to reject outliers
+    constexpr size_t TOTAL_SAMPLES = size_t(1) << 20;
+    constexpr int TOTAL_MEASUREMENTS = 3;
+    const size_t total_runs = std::max(TOTAL_SAMPLES/block_size, size_t(4));
+
+    auto x = AlignedVector<std::complex<float>>(block_size);
+    auto y = AlignedVector<std::complex<float>>(block_size);
+    for (size_t i = 0; i < block_size; i++) {
+        x[i] = std::complex<float>(std::cos(float(i)), std::sin(float(3*i)));
+    }
+
+    FFT_Backend best_backend = FFT_Backend::PORTABLE;
+    auto best_time = std::chrono::steady_clock::duration::max();
+    for (auto backend: BACKENDS) {
+        if (!GetIsFFTBackendAvailable(backend)) continue;
+        auto* kernel = GetCachedKernel({ block_size, false, false, false, backend });
+        // warm up caches and lazily allocated scratch space
+        kernel->Execute(x.data(), y.data(), 1);
+        for (int i = 0; i < TOTAL_MEASUREMENTS; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t j = 0; j < total_runs; j++) {
+                kernel->Execute(x.data(), y.data(), 1);
+            }
+            const auto time = std::chrono::steady_clock::now() - start;
+            if (time < best_time) {
+                best_time = time;
+                best_backend = backend;
+            }
+        }
+    }
+    return best_backend;
+}
+
+static FFT_Backend ResolveBackend(const size_t block_size) {
+    if (fft_backend != FFT_Backend::AUTO) {
+        return fft_backend;
+    }
+    auto res = fft_auto_backends.find(block_size);
+    if (res == fft_auto_backends.end()) {
+        res = fft_auto_backends.insert({ block_size, BenchmarkBackends(block_size) }).first;
+    }
+    return res->second;
+}
+
+static const FFT_Kernel* GetKernel(
+    const size_t block_size, const bool is_inverse, const bool is_inplace, const bool is_batch)
+{
+    auto lock = std::scoped_lock(mutex_fft);
+    const auto backend = ResolveBackend(block_size);
+    return GetCachedKernel({ block_size, is_inverse, is_inplace, is_batch, backend });
+}
+
+bool GetIsFFTBackendAvailable(const FFT_Backend backend) {
+    switch (backend) {
+    case FFT_Backend::AUTO:     return true;
+    case FFT_Backend::PORTABLE: return true;
+    #if defined(GPS_USE_FFTW)
+    case FFT_Backend::FFTW:     return true;
+    #endif
+    #if defined(_DSP_AVX2)
+    // With runtime dispatch the kernel is compiled in but the cpu might not support it
+    case FFT_Backend::AVX2:     return dsp_get_simd_level() >= DSP_SIMD_Level::AVX2;
+    #endif
+    default:                    return false;
+    }
+}
+
+bool SetFFTBackend(const FFT_Backend backend) {
+    if (!GetIsFFTBackendAvailable(backend)) {
+        return false;
+    }
+    auto lock = std::scoped_lock(mutex_fft);
+    fft_backend = backend;
+    return true;
+}
+
+FFT_Backend GetFFTBackend(const size_t block_size) {
+    auto lock = std::scoped_lock(mutex_fft);
+    return ResolveBackend(block_size);
+}
+
+const char* GetFFTBackendName(const FFT_Backend backend) {
+    switch (backend) {
+    case FFT_Backend::AUTO:     return "auto";
+    case FFT_Backend::FFTW:     return "fftw";
+    case FFT_Backend::PORTABLE: return "portable";
+    case FFT_Backend::AVX2:     return "avx2";
+    default:                    return "unknown";
+    }
+}
+
+void SetFFTPlanEffort(const FFT_PlanEffort effort) {
+    #if defined(GPS_USE_FFTW)
+    auto lock = std::scoped_lock(mutex_fft);
+    switch (effort) {
+    case FFT_PlanEffort::ESTIMATE:      fftw_plan_flags = FFTW_ESTIMATE; break;
+    case FFT_PlanEffort::MEASURE:       fftw_plan_flags = FFTW_MEASURE; break;
+    case FFT_PlanEffort::PATIENT:       fftw_plan_flags = FFTW_PATIENT; break;
+    case FFT_PlanEffort::EXHAUSTIVE:    fftw_plan_flags = FFTW_EXHAUSTIVE; break;
+    default:                            fftw_plan_flags = FFTW_ESTIMATE; break;
+    }
+    #else
+    (void)effort;
+    #endif
+}
+
+bool LoadFFTWisdom(const char* filename) {
+    #if defined(GPS_USE_FFTW)
+    auto lock = std::scoped_lock(mutex_fft);
+    return fftwf_import_wisdom_from_filename(filename) != 0;
+    #else
+    (void)filename;
+    return false;
+    #endif
+}
+
+bool SaveFFTWisdom(const char* filename) {
+    #if defined(GPS_USE_FFTW)
+    auto lock = std::scoped_lock(mutex_fft);
+    return fftwf_export_wisdom_to_filename(filename) != 0;
+    #else
+    (void)filename;
+    return false;
+    #endif
+}
+
+FFT_Plan::FFT_Plan(const size_t _block_size, const bool is_inverse, const bool _is_inplace)
+: block_size(_block_size), is_inplace(_is_inplace)
+{
+    kernel = GetKernel(block_size, is_inverse, is_inplace, false);
+}
+
+void FFT_Plan::Execute(
+    tcb::span<const std::complex<float>> x,
+    tcb::span<std::complex<float>> y) const
+{
+    assert(kernel != nullptr);
+    assert(!is_inplace);
+    assert(x.size() == block_size);
+    assert(y.size() == block_size);
+    kernel->Execute(x.data(), y.data(), 1);
+}
+
+void FFT_Plan::ExecuteInplace(tcb::span<std::complex<float>> x) const {
+    assert(kernel != nullptr);
+    assert(is_inplace);
+    assert(x.size() == block_size);
+    kernel->Execute(x.data(), x.data(), 1);
+}
+
+FFT_BatchPlan::FFT_BatchPlan(const size_t _block_size, const bool is_inverse)
+: block_size(_block_size)
+{
+    kernel = GetKernel(block_size, is_inverse, true, true);
+}
+
+void FFT_BatchPlan::ExecuteInplace(tcb::span<std::complex<float>> x) const {
+    assert(kernel != nullptr);
+    const size_t N = x.size();
+    const size_t total_blocks = N / block_size;
+    assert((total_blocks*block_size) == N);
+    kernel->Execute(x.data(), x.data(), total_blocks);
+}
+
 void CalculateFFT(
     tcb::span<const std::complex<float>> x,
     tcb::span<std::complex<float>> y)
 {
     const size_t N = x.size();
-    auto plan = GetPlan(N, false);
-    fftwf_execute_dft(plan, (fftwf_complex*)x.data(), (fftwf_complex*)y.data());
+    auto* kernel = GetKernel(N, false, false, false);
+    kernel->Execute(x.data(), y.data(), 1);
 }
 
 void CalculateIFFT(
@@ -54,6 +417,6 @@ void CalculateIFFT(
     tcb::span<std::complex<float>> y)
 {
     const size_t N = x.size();
-    auto plan = GetPlan(N, true);
-    fftwf_execute_dft(plan, (fftwf_complex*)x.data(), (fftwf_complex*)y.data());
-}
\ No newline at end of file
+    auto* kernel = GetKernel(N, true, false, false);
+    kernel->Execute(x.data(), y.data(), 1);
+}
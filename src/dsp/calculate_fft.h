@@ -1,14 +1,85 @@
 #pragma once
 
 #include <complex>
+#include <vector>
 #include "utility/span.h"
 
-typedef struct fftwf_plan_s* fftwf_plan;
+class FFT_Kernel;
 
+// Implementation that executes the transforms of a plan
+enum class FFT_Backend {
+    // Benchmark the available backends when a block size is first planned and pick the fastest
+    AUTO,
+    FFTW,
+    // Header only radix-4 with bluestein for other sizes
+    PORTABLE,
+    // Same as PORTABLE with avx2 butterflies
+    AVX2,
+};
+
+// Applies to plans that are created after this call
+// Returns false if the backend wasn't compiled in
+bool SetFFTBackend(const FFT_Backend backend);
+bool GetIsFFTBackendAvailable(const FFT_Backend backend);
+// Backend that plans of block_size resolve to
+// NOTE: With AUTO this runs the benchmark if the block size hasn't been planned yet
+FFT_Backend GetFFTBackend(const size_t block_size);
+const char* GetFFTBackendName(const FFT_Backend backend);
+
+// How much effort fftw spends finding a fast plan
+// Anything above ESTIMATE benchmarks transforms when a plan is first created
+enum class FFT_PlanEffort {
+    ESTIMATE,
+    MEASURE,
+    PATIENT,
+    EXHAUSTIVE,
+};
+
+// Applies to fftw plans that are created after this call
+void SetFFTPlanEffort(const FFT_PlanEffort effort);
+// Wisdom stores measured plans so their cost is only paid once per machine
+bool LoadFFTWisdom(const char* filename);
+bool SaveFFTWisdom(const char* filename);
+
+// Plan that is resolved once during setup and executed without taking a lock
+// NOTE: The fftw planner isn't thread safe but executing an existing plan is
+//       Plans are cached for the lifetime of the program so copies of a handle stay valid
+// For fftw buffers with simd alignment like AlignedVector use the aligned plan
+// Anything else falls back to a plan that makes no assumption about alignment
+class FFT_Plan
+{
+private:
+    const FFT_Kernel* kernel = nullptr;
+    size_t block_size = 0;
+    bool is_inplace = false;
+public:
+    FFT_Plan() {}
+    FFT_Plan(const size_t _block_size, const bool is_inverse, const bool _is_inplace=false);
+    void Execute(tcb::span<const std::complex<float>> x, tcb::span<std::complex<float>> y) const;
+    void ExecuteInplace(tcb::span<std::complex<float>> x) const;
+    size_t GetBlockSize() const { return block_size; }
+};
+
+// Inplace transforms of multiple blocks of block_size that are stored contiguously
+// A batched plan is resolved for every chunk size up front so any number of blocks can be executed without a lock
+class FFT_BatchPlan
+{
+private:
+    const FFT_Kernel* kernel = nullptr;
+    size_t block_size = 0;
+public:
+    FFT_BatchPlan() {}
+    FFT_BatchPlan(const size_t _block_size, const bool is_inverse);
+    void ExecuteInplace(tcb::span<std::complex<float>> x) const;
+    size_t GetBlockSize() const { return block_size; }
+};
+
+// NOTE: These resolve the plan on every call which takes a lock
+//       Use FFT_Plan or FFT_BatchPlan for repeated transforms
 void CalculateFFT(
     tcb::span<const std::complex<float>> x,
     tcb::span<std::complex<float>> y);
 
 void CalculateIFFT(
     tcb::span<const std::complex<float>> x,
-    tcb::span<std::complex<float>> y);
\ No newline at end of file
+    tcb::span<std::complex<float>> y);
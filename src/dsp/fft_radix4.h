@@ -0,0 +1,345 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include "utility/aligned_vector.h"
+
+// Header only fft that doesn't depend on fftw
+// FFT_Radix4: Stockham autosort radix-4 with a final radix-2 stage for power of two sizes
+// FFT_Bluestein: Arbitrary sizes as a circular convolution done with power of two ffts
+// NOTE: Like fftw the inverse transform is unnormalised
+// NOTE: Stockham ping pongs between two buffers so execution needs scratch space from the caller
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "simd/simd_config.h"
+#include "simd/c32_mul.h"
+
+constexpr double FFT_PI = 3.14159265358979323846;
+
+static inline bool fft_is_power_of_two(const size_t N) {
+    return (N > 0) && ((N & (N-1)) == 0);
+}
+
+class FFT_Radix4
+{
+private:
+    // Stage that splits transforms of size n with a stride of s into 4 transforms of size n/4
+    struct Stage {
+        size_t n;
+        size_t s;
+        // [w1,w2,w3][n/4] where wk[p] = e^(-+2*pi*j*k*p/n)
+        AlignedVector<std::complex<float>> twiddles;
+    };
+    size_t block_size = 0;
+    bool is_inverse = false;
+    std::vector<Stage> stages;
+    // block sizes that are an odd power of two end with a radix-2 stage
+    bool is_radix2_stage = false;
+public:
+    FFT_Radix4() {}
+    FFT_Radix4(const size_t _block_size, const bool _is_inverse)
+    : block_size(_block_size), is_inverse(_is_inverse)
+    {
+        assert(fft_is_power_of_two(block_size));
+        const double sign = is_inverse ? +1.0 : -1.0;
+        size_t n = block_size;
+        size_t s = 1;
+        while (n >= 4) {
+            const size_t m = n/4;
+            auto twiddles = AlignedVector<std::complex<float>>(3*m);
+            for (size_t p = 0; p < m; p++) {
+                for (size_t k = 1; k <= 3; k++) {
+                    const double phase = sign*2.0*FFT_PI*double(k*p)/double(n);
+                    twiddles[(k-1)*m + p] = std::complex<float>(float(std::cos(phase)), float(std::sin(phase)));
+                }
+            }
+            stages.push_back({ n, s, std::move(twiddles) });
+            n = n/4;
+            s = s*4;
+        }
+        is_radix2_stage = (n == 2);
+    }
+    size_t GetBlockSize() const { return block_size; }
+    size_t GetScratchSize() const { return block_size; }
+    // x and y can be the same array for an inplace transform
+    void Execute(const std::complex<float>* x, std::complex<float>* y, std::complex<float>* scratch, const bool is_simd) const {
+        const size_t N = block_size;
+        const size_t total_stages = stages.size() + (is_radix2_stage ? 1 : 0);
+        if (total_stages == 0) {
+            if (x != y) y[0] = x[0];
+            return;
+        }
+        // The last stage has to write to y so the starting buffer depends on the number of stages
+        // If an inplace transform starts by writing to y then the input is moved to scratch first
+        const std::complex<float>* src = x;
+        if ((x == y) && ((total_stages % 2) == 1)) {
+            for (size_t i = 0; i < N; i++) {
+                scratch[i] = x[i];
+            }
+            src = scratch;
+        }
+        for (size_t i = 0; i < total_stages; i++) {
+            const bool is_write_y = ((total_stages-i) % 2) == 1;
+            auto* dst = is_write_y ? y : scratch;
+            if (i < stages.size()) {
+                ExecuteRadix4(stages[i], src, dst, is_simd);
+            } else {
+                ExecuteRadix2(src, dst, is_simd);
+            }
+            src = dst;
+        }
+    }
+private:
+    void ExecuteRadix4(const Stage& stage, const std::complex<float>* x, std::complex<float>* y, const bool is_simd) const {
+        #if defined(_DSP_AVX2)
+        // Stride of 1 is vectorised over p and strides of 4 or more over q
+        if (is_simd && ((stage.s % 4) == 0)) {
+            return radix4_stage_strided_avx2(stage, x, y);
+        }
+        if (is_simd && (stage.s == 1) && ((stage.n % 16) == 0)) {
+            return radix4_stage_first_avx2(stage, x, y);
+        }
+        #else
+        (void)is_simd;
+        #endif
+        if (is_inverse) {
+            radix4_stage_scalar<true>(stage, x, y);
+        } else {
+            radix4_stage_scalar<false>(stage, x, y);
+        }
+    }
+
+    void ExecuteRadix2(const std::complex<float>* x, std::complex<float>* y, const bool is_simd) const {
+        const size_t s = block_size/2;
+        size_t q = 0;
+        #if defined(_DSP_AVX2)
+        if (is_simd) {
+            q = radix2_stage_avx2(x, y);
+        }
+        #else
+        (void)is_simd;
+        #endif
+        for (; q < s; q++) {
+            const auto a = x[q];
+            const auto b = x[q+s];
+            y[q] = a+b;
+            y[q+s] = a-b;
+        }
+    }
+
+    template <bool IS_INVERSE>
+    void radix4_stage_scalar(const Stage& stage, const std::complex<float>* x, std::complex<float>* y) const {
+        const size_t s = stage.s;
+        const size_t m = stage.n/4;
+        const auto* w1 = stage.twiddles.data();
+        const auto* w2 = w1 + m;
+        const auto* w3 = w2 + m;
+        for (size_t p = 0; p < m; p++) {
+            for (size_t q = 0; q < s; q++) {
+                const auto a = x[q + s*(p+0*m)];
+                const auto b = x[q + s*(p+1*m)];
+                const auto c = x[q + s*(p+2*m)];
+                const auto d = x[q + s*(p+3*m)];
+                const auto apc = a+c;
+                const auto amc = a-c;
+                const auto bpd = b+d;
+                // forward: j*(b-d), inverse: -j*(b-d)
+                const auto bmd = b-d;
+                const auto jbmd = IS_INVERSE ?
+                    std::complex<float>(bmd.imag(), -bmd.real()) :
+                    std::complex<float>(-bmd.imag(), bmd.real());
+                y[q + s*(4*p+0)] = apc+bpd;
+                y[q + s*(4*p+1)] = w1[p]*(amc-jbmd);
+                y[q + s*(4*p+2)] = w2[p]*(apc-bpd);
+                y[q + s*(4*p+3)] = w3[p]*(amc+jbmd);
+            }
+        }
+    }
+
+    #if defined(_DSP_AVX2)
+    // [re im] -> j*[re im] = [-im re]
+    static DSP_FORCE_INLINE DSP_TARGET_AVX2 __m256 c32_mul_j_avx2(__m256 x) {
+        // [3 2 1 0] -> [2 3 0 1]
+        constexpr uint8_t SWAP_COMPONENT_MASK = 0b10110001;
+        // NOTE: Flipping the sign bit with an xor mask gave wrong results under -ffast-math
+        //       so subtract from zero instead
+        return _mm256_addsub_ps(_mm256_setzero_ps(), _mm256_permute_ps(x, SWAP_COMPONENT_MASK));
+    }
+
+    DSP_FORCE_INLINE DSP_TARGET_AVX2 void radix4_butterfly_avx2(
+        __m256 a, __m256 b, __m256 c, __m256 d, __m256 w1, __m256 w2, __m256 w3,
+        __m256& y0, __m256& y1, __m256& y2, __m256& y3) const
+    {
+        const __m256 apc = _mm256_add_ps(a, c);
+        const __m256 amc = _mm256_sub_ps(a, c);
+        const __m256 bpd = _mm256_add_ps(b, d);
+        const __m256 jbmd = c32_mul_j_avx2(_mm256_sub_ps(b, d));
+        // inverse transform uses -j*(b-d)
+        const __m256 y1_in = is_inverse ? _mm256_add_ps(amc, jbmd) : _mm256_sub_ps(amc, jbmd);
+        const __m256 y3_in = is_inverse ? _mm256_sub_ps(amc, jbmd) : _mm256_add_ps(amc, jbmd);
+        y0 = _mm256_add_ps(apc, bpd);
+        y1 = c32_mul_avx2(w1, y1_in);
+        y2 = c32_mul_avx2(w2, _mm256_sub_ps(apc, bpd));
+        y3 = c32_mul_avx2(w3, y3_in);
+    }
+
+    // Stride of 4 or more so 4 contiguous values of q share the same twiddle
+    DSP_TARGET_AVX2 void radix4_stage_strided_avx2(const Stage& stage, const std::complex<float>* x, std::complex<float>* y) const {
+        // 256bits = 32bytes = 4*8bytes
+        constexpr size_t K = 4;
+        const size_t s = stage.s;
+        const size_t m = stage.n/4;
+        const auto* w = stage.twiddles.data();
+        for (size_t p = 0; p < m; p++) {
+            const __m256 w1 = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&w[p])));
+            const __m256 w2 = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&w[m+p])));
+            const __m256 w3 = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&w[2*m+p])));
+            const auto* x0 = reinterpret_cast<const float*>(&x[s*p]);
+            auto* y0 = reinterpret_cast<float*>(&y[s*4*p]);
+            // offsets in floats
+            const size_t xs = 2*s*m;
+            const size_t ys = 2*s;
+            for (size_t q = 0; q < 2*s; q+=2*K) {
+                __m256 b0, b1, b2, b3;
+                radix4_butterfly_avx2(
+                    _mm256_loadu_ps(&x0[q]), _mm256_loadu_ps(&x0[q+xs]),
+                    _mm256_loadu_ps(&x0[q+2*xs]), _mm256_loadu_ps(&x0[q+3*xs]),
+                    w1, w2, w3, b0, b1, b2, b3);
+                _mm256_storeu_ps(&y0[q],      b0);
+                _mm256_storeu_ps(&y0[q+ys],   b1);
+                _mm256_storeu_ps(&y0[q+2*ys], b2);
+                _mm256_storeu_ps(&y0[q+3*ys], b3);
+            }
+        }
+    }
+
+    // Returns the number of butterflies done so the caller can finish the tail
+    DSP_TARGET_AVX2 size_t radix2_stage_avx2(const std::complex<float>* x, std::complex<float>* y) const {
+        // 256bits = 32bytes = 4*8bytes
+        constexpr size_t K = 4;
+        const size_t s = block_size/2;
+        size_t q = 0;
+        for (; (q+K) <= s; q+=K) {
+            __m256 a = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[q]));
+            __m256 b = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[q+s]));
+            _mm256_storeu_ps(reinterpret_cast<float*>(&y[q]),   _mm256_add_ps(a, b));
+            _mm256_storeu_ps(reinterpret_cast<float*>(&y[q+s]), _mm256_sub_ps(a, b));
+        }
+        return q;
+    }
+
+    // Stride of 1 so 4 contiguous values of p are loaded and the outputs are transposed before storing
+    DSP_TARGET_AVX2 void radix4_stage_first_avx2(const Stage& stage, const std::complex<float>* x, std::complex<float>* y) const {
+        // 256bits = 32bytes = 4*8bytes
+        constexpr size_t K = 4;
+        const size_t m = stage.n/4;
+        const auto* w = reinterpret_cast<const float*>(stage.twiddles.data());
+        const auto* x0 = reinterpret_cast<const float*>(x);
+        auto* y0 = reinterpret_cast<float*>(y);
+        // offsets in floats
+        const size_t xs = 2*m;
+        for (size_t p = 0; p < 2*m; p+=2*K) {
+            __m256 b0, b1, b2, b3;
+            radix4_butterfly_avx2(
+                _mm256_loadu_ps(&x0[p]), _mm256_loadu_ps(&x0[p+xs]),
+                _mm256_loadu_ps(&x0[p+2*xs]), _mm256_loadu_ps(&x0[p+3*xs]),
+                _mm256_loadu_ps(&w[p]), _mm256_loadu_ps(&w[p+xs]), _mm256_loadu_ps(&w[p+2*xs]),
+                b0, b1, b2, b3);
+            // Transpose 4x4 complex values so outputs of each butterfly are contiguous
+            // bk = [p0 p1 | p2 p3] -> yp = [b0 b1 | b2 b3]
+            const __m256d t0 = _mm256_unpacklo_pd(_mm256_castps_pd(b0), _mm256_castps_pd(b1));
+            const __m256d t1 = _mm256_unpackhi_pd(_mm256_castps_pd(b0), _mm256_castps_pd(b1));
+            const __m256d t2 = _mm256_unpacklo_pd(_mm256_castps_pd(b2), _mm256_castps_pd(b3));
+            const __m256d t3 = _mm256_unpackhi_pd(_mm256_castps_pd(b2), _mm256_castps_pd(b3));
+            auto* y1 = &y0[4*p];
+            _mm256_storeu_ps(&y1[0],  _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x20)));
+            _mm256_storeu_ps(&y1[8],  _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x20)));
+            _mm256_storeu_ps(&y1[16], _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x31)));
+            _mm256_storeu_ps(&y1[24], _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x31)));
+        }
+    }
+    #endif
+};
+
+class FFT_Bluestein
+{
+private:
+    size_t block_size = 0;
+    // size of power of two transforms for the circular convolution
+    size_t conv_size = 0;
+    // chirp c[n] = e^(-+j*pi*n^2/N)
+    AlignedVector<std::complex<float>> chirp;
+    // normalised spectrum of conj(c[n]) wrapped around for negative n
+    AlignedVector<std::complex<float>> chirp_fft;
+    FFT_Radix4 fft;
+    FFT_Radix4 ifft;
+public:
+    FFT_Bluestein() {}
+    FFT_Bluestein(const size_t _block_size, const bool is_inverse)
+    : block_size(_block_size)
+    {
+        const size_t N = block_size;
+        conv_size = 1;
+        while (conv_size < (2*N-1)) {
+            conv_size *= 2;
+        }
+        const size_t M = conv_size;
+        fft = FFT_Radix4(M, false);
+        ifft = FFT_Radix4(M, true);
+
+        // 2nk = n^2 + k^2 - (k-n)^2 so X[k] = c[k] * sum x[n]*c[n]*conj(c[k-n])
+        // NOTE: n^2 is reduced modulo 2N in integers since the chirp has a period of 2N
+        const double sign = is_inverse ? +1.0 : -1.0;
+        chirp = AlignedVector<std::complex<float>>(N);
+        for (size_t n = 0; n < N; n++) {
+            const uint64_t n2 = (uint64_t(n)*uint64_t(n)) % uint64_t(2*N);
+            const double phase = sign*FFT_PI*double(n2)/double(N);
+            chirp[n] = std::complex<float>(float(std::cos(phase)), float(std::sin(phase)));
+        }
+
+        chirp_fft = AlignedVector<std::complex<float>>(M);
+        auto scratch = AlignedVector<std::complex<float>>(M);
+        for (size_t i = 0; i < M; i++) {
+            chirp_fft[i] = 0.0f;
+        }
+        chirp_fft[0] = std::conj(chirp[0]);
+        for (size_t n = 1; n < N; n++) {
+            chirp_fft[n] = std::conj(chirp[n]);
+            chirp_fft[M-n] = std::conj(chirp[n]);
+        }
+        fft.Execute(chirp_fft.data(), chirp_fft.data(), scratch.data(), false);
+        const float scale = 1.0f/float(M);
+        for (size_t i = 0; i < M; i++) {
+            chirp_fft[i] *= scale;
+        }
+    }
+    size_t GetBlockSize() const { return block_size; }
+    size_t GetScratchSize() const { return 2*conv_size; }
+    // x and y can be the same array for an inplace transform
+    void Execute(const std::complex<float>* x, std::complex<float>* y, std::complex<float>* scratch, const bool is_simd) const {
+        const size_t N = block_size;
+        const size_t M = conv_size;
+        const auto* c = chirp.data();
+        const auto* C = chirp_fft.data();
+        auto* a = &scratch[0];
+        auto* fft_scratch = &scratch[M];
+        for (size_t i = 0; i < N; i++) {
+            a[i] = x[i]*c[i];
+        }
+        for (size_t i = N; i < M; i++) {
+            a[i] = 0.0f;
+        }
+        fft.Execute(a, a, fft_scratch, is_simd);
+        for (size_t i = 0; i < M; i++) {
+            a[i] *= C[i];
+        }
+        ifft.Execute(a, a, fft_scratch, is_simd);
+        for (size_t i = 0; i < N; i++) {
+            y[i] = a[i]*c[i];
+        }
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <assert.h>
+#include <complex>
+
+// Dot product of vector of complex floats with vector of real floats
+// y = sum(x0[i] * x1[i])
+
+static inline
+std::complex<float> c32_f32_vec_dot_scalar(
+    const std::complex<float>* x0,
+    const float* x1,
+    const int N)
+{
+    std::complex<float> y = 0.0f;
+    for (int i = 0; i < N; i++) {
+        y += x0[i] * x1[i];
+    }
+    return y;
+}
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "simd_config.h"
+#include "cpu_features.h"
+
+#if defined(_DSP_SSSE3)
+static inline DSP_TARGET_SSSE3
+std::complex<float> c32_f32_vec_dot_ssse3(
+    const std::complex<float>* x0,
+    const float* x1,
+    const int N)
+{
+    // 128bits = 2 complex floats
+    constexpr int K = 2;
+    const int M = N/K;
+
+    __m128 v_sum = _mm_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(&x0[i*K]));
+        // [b a] -> [b b a a]
+        __m128 a1 = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&x1[i*K])));
+        a1 = _mm_unpacklo_ps(a1, a1);
+        v_sum = _mm_add_ps(v_sum, _mm_mul_ps(a0, a1));
+    }
+
+    alignas(16) std::complex<float> lane_sum[K];
+    _mm_store_ps(reinterpret_cast<float*>(lane_sum), v_sum);
+    std::complex<float> y = lane_sum[0] + lane_sum[1];
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    y += c32_f32_vec_dot_scalar(&x0[N_vector], &x1[N_vector], N_remain);
+    return y;
+}
+#endif
+
+#if defined(_DSP_AVX2)
+static inline DSP_TARGET_AVX2
+std::complex<float> c32_f32_vec_dot_avx2(
+    const std::complex<float>* x0,
+    const float* x1,
+    const int N)
+{
+    // 256bits = 4 complex floats
+    constexpr int K = 4;
+    const int M = N/K;
+
+    // [d c b a] -> [d d c c b b a a]
+    const __m256i DUPLICATE_INDEX = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+
+    __m256 v_sum = _mm256_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        __m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x0[i*K]));
+        __m256 a1 = _mm256_castps128_ps256(_mm_loadu_ps(&x1[i*K]));
+        a1 = _mm256_permutevar8x32_ps(a1, DUPLICATE_INDEX);
+        #if !defined(_DSP_FMA)
+        v_sum = _mm256_add_ps(v_sum, _mm256_mul_ps(a0, a1));
+        #else
+        v_sum = _mm256_fmadd_ps(a0, a1, v_sum);
+        #endif
+    }
+
+    alignas(32) std::complex<float> lane_sum[K];
+    _mm256_store_ps(reinterpret_cast<float*>(lane_sum), v_sum);
+    std::complex<float> y = (lane_sum[0] + lane_sum[1]) + (lane_sum[2] + lane_sum[3]);
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    y += c32_f32_vec_dot_scalar(&x0[N_vector], &x1[N_vector], N_remain);
+    return y;
+}
+#endif
+
+inline static
+std::complex<float> c32_f32_vec_dot_auto(
+    const std::complex<float>* x0,
+    const float* x1,
+    const int N)
+{
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&c32_f32_vec_dot_avx2, &c32_f32_vec_dot_ssse3, &c32_f32_vec_dot_scalar);
+    return kernel(x0, x1, N);
+    #elif defined(_DSP_AVX2)
+    return c32_f32_vec_dot_avx2(x0, x1, N);
+    #elif defined(_DSP_SSSE3)
+    return c32_f32_vec_dot_ssse3(x0, x1, N);
+    #else
+    return c32_f32_vec_dot_scalar(x0, x1, N);
+    #endif
+}
@@ -6,8 +6,50 @@
 
 // Multiply packed complex float 
 
+#if defined(_DSP_AVX512)
+static inline DSP_TARGET_AVX512
+__m512 c32_mul_avx512(__m512 x0, __m512 x1) {
+    // Vectorise complex multiplication
+    // Permutes are done within each 128bit lane like avx2
+    // NOTE: Shuffling a register with itself is the same as _mm512_permute_ps which gcc warns
+    //       reads an uninitialised operand
+    // [3 2 1 0] -> [2 3 0 1]
+    constexpr uint8_t SWAP_COMPONENT_MASK = 0b10110001;
+    // [3 2 1 0] -> [2 2 0 0]
+    constexpr uint8_t GET_REAL_MASK = 0b10100000;
+    // [3 2 1 0] -> [3 3 1 1]
+    constexpr uint8_t GET_IMAG_MASK = 0b11110101;
+
+    // [d c]
+    __m512 a0 = _mm512_shuffle_ps(x0, x0, SWAP_COMPONENT_MASK);
+    // [a a]
+    __m512 a1 = _mm512_shuffle_ps(x1, x1, GET_REAL_MASK);
+    // [b b]
+    __m512 a2 = _mm512_shuffle_ps(x1, x1, GET_IMAG_MASK);
+    // [bd bc]
+    __m512 b0 = _mm512_mul_ps(a2, a0);
+    // [ac-bd ad+bc]
+    __m512 y = _mm512_fmaddsub_ps(a1, x0, b0);
+    return y;
+}
+
+// Squared magnitude of 2 packed registers of complex floats
+// [I0 Q0 ... I7 Q7], [I8 Q8 ... I15 Q15] -> [|x0|^2 ... |x15|^2]
+static inline DSP_TARGET_AVX512
+__m512 c32_mag_squared_avx512(__m512 x0, __m512 x1) {
+    // There is no 512bit horizontal add so deinterleave the squared components instead
+    const __m512i EVEN_INDEX = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i ODD_INDEX = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    x0 = _mm512_mul_ps(x0, x0);
+    x1 = _mm512_mul_ps(x1, x1);
+    return _mm512_add_ps(
+        _mm512_permutex2var_ps(x0, EVEN_INDEX, x1),
+        _mm512_permutex2var_ps(x0, ODD_INDEX, x1));
+}
+#endif
+
 #if defined(_DSP_AVX2)
-static inline
+static inline DSP_TARGET_AVX2
 __m256 c32_mul_avx2(__m256 x0, __m256 x1) {
     // Vectorise complex multiplication
     // [3 2 1 0] -> [2 3 0 1]
@@ -41,7 +83,7 @@ __m256 c32_mul_avx2(__m256 x0, __m256 x1) {
 #endif
 
 #if defined(_DSP_SSSE3)
-static inline
+static inline DSP_TARGET_SSSE3
 __m128 c32_mul_ssse3(__m128 x0, __m128 x1) {
     // Vectorise complex multiplication
     // [3 2 1 0] -> [2 3 0 1]
@@ -60,7 +102,7 @@ __m128 c32_mul_ssse3(__m128 x0, __m128 x1) {
     // [bd bc]
     __m128 b0 = _mm_mul_ps(a2, a0);
 
-    #if !defined(_DSP_FMA)
+    #if !defined(_DSP_SSSE3_FMA)
     // [ac ad]
     __m128 b1 = _mm_mul_ps(a1, x1);
     // [ac-bd ad+bc]
@@ -0,0 +1,173 @@
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <complex>
+
+// Accumulate scaled squared magnitude of vector of complex floats
+// y[i] += scale*|x[i]|^2
+
+static inline
+void c32_vec_mag_accumulate_scalar(
+    const std::complex<float>* x, 
+    float* y, 
+    const int N,
+    const float scale)
+{
+    for (int i = 0; i < N; i++) {
+        const float I = x[i].real();
+        const float Q = x[i].imag();
+        y[i] += (I*I + Q*Q)*scale;
+    }
+}
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "simd_config.h"
+#include "cpu_features.h"
+#include "c32_mul.h"
+
+#if defined(_DSP_SSSE3)
+template <int N_FIXED=0>
+static inline DSP_TARGET_SSSE3
+void c32_vec_mag_accumulate_ssse3(
+    const std::complex<float>* x, 
+    float* y, 
+    const int N_runtime,
+    const float scale)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*128bits = 4 complex floats = 4 magnitudes
+    constexpr int K = 4;
+    const int M = N/K;
+
+    const __m128 v_scale = _mm_set1_ps(scale);
+    for (int i = 0; i < M; i++) {
+        __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m128 a1 = _mm_loadu_ps(reinterpret_cast<const float*>(&x[i*K+2]));
+        a0 = _mm_mul_ps(a0, a0);
+        a1 = _mm_mul_ps(a1, a1);
+        __m128 b0 = _mm_hadd_ps(a0, a1);
+        __m128 y0 = _mm_loadu_ps(&y[i*K]);
+        #if !defined(_DSP_SSSE3_FMA)
+        y0 = _mm_add_ps(y0, _mm_mul_ps(b0, v_scale));
+        #else
+        y0 = _mm_fmadd_ps(b0, v_scale, y0);
+        #endif
+        _mm_storeu_ps(&y[i*K], y0);
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    c32_vec_mag_accumulate_scalar(&x[N_vector], &y[N_vector], N_remain, scale);
+}
+#endif
+
+#if defined(_DSP_AVX2)
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX2
+void c32_vec_mag_accumulate_avx2(
+    const std::complex<float>* x, 
+    float* y, 
+    const int N_runtime,
+    const float scale)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*256bits = 8 complex floats = 8 magnitudes
+    constexpr int K = 8;
+    const int M = N/K;
+
+    // [3 2 1 0] -> [3 1 2 0]
+    constexpr uint8_t REORDER_LANE_MASK = 0b11011000;
+
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    for (int i = 0; i < M; i++) {
+        __m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m256 a1 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[i*K+4]));
+        a0 = _mm256_mul_ps(a0, a0);
+        a1 = _mm256_mul_ps(a1, a1);
+        // [0 1 4 5 | 2 3 6 7] -> [0 1 2 3 | 4 5 6 7]
+        __m256 b0 = _mm256_hadd_ps(a0, a1);
+        b0 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(b0), REORDER_LANE_MASK));
+        __m256 y0 = _mm256_loadu_ps(&y[i*K]);
+        #if !defined(_DSP_FMA)
+        y0 = _mm256_add_ps(y0, _mm256_mul_ps(b0, v_scale));
+        #else
+        y0 = _mm256_fmadd_ps(b0, v_scale, y0);
+        #endif
+        _mm256_storeu_ps(&y[i*K], y0);
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    c32_vec_mag_accumulate_scalar(&x[N_vector], &y[N_vector], N_remain, scale);
+}
+#endif
+
+#if defined(_DSP_AVX512)
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX512
+void c32_vec_mag_accumulate_avx512(
+    const std::complex<float>* x, 
+    float* y, 
+    const int N_runtime,
+    const float scale)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*512bits = 16 complex floats = 16 magnitudes
+    constexpr int K = 16;
+    const int M = N/K;
+
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    for (int i = 0; i < M; i++) {
+        __m512 a0 = _mm512_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m512 a1 = _mm512_loadu_ps(reinterpret_cast<const float*>(&x[i*K+8]));
+        __m512 b0 = c32_mag_squared_avx512(a0, a1);
+        __m512 y0 = _mm512_loadu_ps(&y[i*K]);
+        y0 = _mm512_fmadd_ps(b0, v_scale, y0);
+        _mm512_storeu_ps(&y[i*K], y0);
+    }
+
+    // Masked loads and stores for the tail instead of a scalar loop
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    if (N_remain > 0) {
+        const int N_lo = std::min(N_remain, K/2);
+        const int N_hi = N_remain-N_lo;
+        const __mmask16 mask_lo = __mmask16((1u << (2*N_lo)) - 1u);
+        const __mmask16 mask_hi = __mmask16((1u << (2*N_hi)) - 1u);
+        const __mmask16 mask = __mmask16((1u << N_remain) - 1u);
+        __m512 a0 = _mm512_maskz_loadu_ps(mask_lo, reinterpret_cast<const float*>(&x[N_vector]));
+        __m512 a1 = _mm512_maskz_loadu_ps(mask_hi, reinterpret_cast<const float*>(&x[N_vector+8]));
+        __m512 b0 = c32_mag_squared_avx512(a0, a1);
+        __m512 y0 = _mm512_maskz_loadu_ps(mask, &y[N_vector]);
+        y0 = _mm512_fmadd_ps(b0, v_scale, y0);
+        _mm512_mask_storeu_ps(&y[N_vector], mask, y0);
+    }
+}
+#endif
+
+template <int N_FIXED=0>
+inline static 
+void c32_vec_mag_accumulate_auto(
+    const std::complex<float>* x, 
+    float* y, 
+    const int N,
+    const float scale)
+{
+    assert((N_FIXED == 0) || (N == N_FIXED));
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(
+        &c32_vec_mag_accumulate_avx512<N_FIXED>, &c32_vec_mag_accumulate_avx2<N_FIXED>, 
+        &c32_vec_mag_accumulate_ssse3<N_FIXED>, &c32_vec_mag_accumulate_scalar);
+    return kernel(x, y, N, scale);
+    #elif defined(_DSP_AVX512)
+    return c32_vec_mag_accumulate_avx512<N_FIXED>(x, y, N, scale);
+    #elif defined(_DSP_AVX2)
+    return c32_vec_mag_accumulate_avx2<N_FIXED>(x, y, N, scale);
+    #elif defined(_DSP_SSSE3)
+    return c32_vec_mag_accumulate_ssse3<N_FIXED>(x, y, N, scale);
+    #else
+    return c32_vec_mag_accumulate_scalar(x, y, N, scale);
+    #endif
+}
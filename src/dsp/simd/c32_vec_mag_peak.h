@@ -0,0 +1,489 @@
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <complex>
+#include "simd_config.h"
+#include "cpu_features.h"
+
+// Magnitude of vector of complex floats with peak statistics
+// This is done in a single pass over the complex input
+// The second peak is searched for in the magnitude output which should still be in L1 cache
+
+struct vec_peak_t {
+    int index = 0;
+    float value = 0.0f;
+    // largest value outside of the exclusion zone of the peak
+    int second_index = 0;
+    float second_value = 0.0f;
+    float mean = 0.0f;
+};
+
+static inline
+void f32_vec_argmax_scalar(
+    const float* x, const int N, const int index_offset,
+    int& peak_index, float& peak_value)
+{
+    for (int i = 0; i < N; i++) {
+        const float v = x[i];
+        if (v > peak_value) {
+            peak_value = v;
+            peak_index = index_offset+i;
+        }
+    }
+}
+
+static DSP_FORCE_INLINE
+void c32_vec_mag_argmax_scalar(
+    const std::complex<float>* x, float* y, const int N, const int index_offset,
+    const float scale, const bool is_squared,
+    int& peak_index, float& peak_value, float& sum)
+{
+    for (int i = 0; i < N; i++) {
+        const float I = x[i].real();
+        const float Q = x[i].imag();
+        float v = I*I + Q*Q;
+        if (!is_squared) {
+            v = std::sqrt(v);
+        }
+        v = v*scale;
+        y[i] = v;
+        sum += v;
+        if (v > peak_value) {
+            peak_value = v;
+            peak_index = index_offset+i;
+        }
+    }
+}
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "c32_mul.h"
+
+#if defined(_DSP_SSSE3)
+template <int N_FIXED=0>
+static inline DSP_TARGET_SSSE3
+void f32_vec_argmax_ssse3(
+    const float* x, const int N_runtime, const int index_offset,
+    int& peak_index, float& peak_value)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 128bits = 16bytes = 4*4bytes
+    constexpr int K = 4;
+    const int M = N/K;
+
+    __m128 v_max = _mm_set1_ps(peak_value);
+    __m128i v_max_index = _mm_set1_epi32(peak_index);
+    __m128i v_index = _mm_setr_epi32(0, 1, 2, 3);
+    v_index = _mm_add_epi32(v_index, _mm_set1_epi32(index_offset));
+    const __m128i v_index_step = _mm_set1_epi32(K);
+
+    for (int i = 0; i < M; i++) {
+        __m128 a0 = _mm_loadu_ps(&x[i*K]);
+        __m128 mask = _mm_cmpgt_ps(a0, v_max);
+        __m128i mask_i = _mm_castps_si128(mask);
+        v_max = _mm_or_ps(_mm_and_ps(mask, a0), _mm_andnot_ps(mask, v_max));
+        v_max_index = _mm_or_si128(_mm_and_si128(mask_i, v_index), _mm_andnot_si128(mask_i, v_max_index));
+        v_index = _mm_add_epi32(v_index, v_index_step);
+    }
+
+    // Pick the largest lane, and the earliest index if there is a tie
+    alignas(16) float lane_max[K];
+    alignas(16) int lane_index[K];
+    _mm_store_ps(lane_max, v_max);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    f32_vec_argmax_scalar(&x[N_vector], N_remain, index_offset+N_vector, peak_index, peak_value);
+}
+
+template <int N_FIXED=0>
+static DSP_FORCE_INLINE DSP_TARGET_SSSE3
+void c32_vec_mag_argmax_ssse3(
+    const std::complex<float>* x, float* y, const int N_runtime, const int index_offset,
+    const float scale, const bool is_squared,
+    int& peak_index, float& peak_value, float& sum)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*128bits = 4 complex floats = 4 magnitudes
+    constexpr int K = 4;
+    const int M = N/K;
+
+    const __m128 v_scale = _mm_set1_ps(scale);
+    __m128 v_sum = _mm_setzero_ps();
+    __m128 v_max = _mm_set1_ps(peak_value);
+    __m128i v_max_index = _mm_set1_epi32(peak_index);
+    __m128i v_index = _mm_setr_epi32(0, 1, 2, 3);
+    v_index = _mm_add_epi32(v_index, _mm_set1_epi32(index_offset));
+    const __m128i v_index_step = _mm_set1_epi32(K);
+
+    for (int i = 0; i < M; i++) {
+        __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m128 a1 = _mm_loadu_ps(reinterpret_cast<const float*>(&x[i*K+2]));
+        a0 = _mm_mul_ps(a0, a0);
+        a1 = _mm_mul_ps(a1, a1);
+        // [I0^2+Q0^2, I1^2+Q1^2, I2^2+Q2^2, I3^2+Q3^2]
+        __m128 b0 = _mm_hadd_ps(a0, a1);
+        if (!is_squared) {
+            b0 = _mm_sqrt_ps(b0);
+        }
+        b0 = _mm_mul_ps(b0, v_scale);
+        _mm_storeu_ps(&y[i*K], b0);
+        v_sum = _mm_add_ps(v_sum, b0);
+
+        __m128 mask = _mm_cmpgt_ps(b0, v_max);
+        __m128i mask_i = _mm_castps_si128(mask);
+        v_max = _mm_or_ps(_mm_and_ps(mask, b0), _mm_andnot_ps(mask, v_max));
+        v_max_index = _mm_or_si128(_mm_and_si128(mask_i, v_index), _mm_andnot_si128(mask_i, v_max_index));
+        v_index = _mm_add_epi32(v_index, v_index_step);
+    }
+
+    alignas(16) float lane_sum[K];
+    alignas(16) float lane_max[K];
+    alignas(16) int lane_index[K];
+    _mm_store_ps(lane_sum, v_sum);
+    _mm_store_ps(lane_max, v_max);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        sum += lane_sum[i];
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    c32_vec_mag_argmax_scalar(
+        &x[N_vector], &y[N_vector], N_remain, index_offset+N_vector,
+        scale, is_squared, peak_index, peak_value, sum);
+}
+#endif
+
+#if defined(_DSP_AVX2)
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX2
+void f32_vec_argmax_avx2(
+    const float* x, const int N_runtime, const int index_offset,
+    int& peak_index, float& peak_value)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 256bits = 32bytes = 8*4bytes
+    constexpr int K = 8;
+    const int M = N/K;
+
+    __m256 v_max = _mm256_set1_ps(peak_value);
+    __m256i v_max_index = _mm256_set1_epi32(peak_index);
+    __m256i v_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    v_index = _mm256_add_epi32(v_index, _mm256_set1_epi32(index_offset));
+    const __m256i v_index_step = _mm256_set1_epi32(K);
+
+    for (int i = 0; i < M; i++) {
+        __m256 a0 = _mm256_loadu_ps(&x[i*K]);
+        __m256 mask = _mm256_cmp_ps(a0, v_max, _CMP_GT_OQ);
+        v_max = _mm256_blendv_ps(v_max, a0, mask);
+        v_max_index = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(v_max_index), _mm256_castsi256_ps(v_index), mask));
+        v_index = _mm256_add_epi32(v_index, v_index_step);
+    }
+
+    // Pick the largest lane, and the earliest index if there is a tie
+    alignas(32) float lane_max[K];
+    alignas(32) int lane_index[K];
+    _mm256_store_ps(lane_max, v_max);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    f32_vec_argmax_scalar(&x[N_vector], N_remain, index_offset+N_vector, peak_index, peak_value);
+}
+
+template <int N_FIXED=0>
+static DSP_FORCE_INLINE DSP_TARGET_AVX2
+void c32_vec_mag_argmax_avx2(
+    const std::complex<float>* x, float* y, const int N_runtime, const int index_offset,
+    const float scale, const bool is_squared,
+    int& peak_index, float& peak_value, float& sum)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*256bits = 8 complex floats = 8 magnitudes
+    constexpr int K = 8;
+    const int M = N/K;
+
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    __m256 v_sum = _mm256_setzero_ps();
+    __m256 v_max = _mm256_set1_ps(peak_value);
+    __m256i v_max_index = _mm256_set1_epi32(peak_index);
+    __m256i v_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    v_index = _mm256_add_epi32(v_index, _mm256_set1_epi32(index_offset));
+    const __m256i v_index_step = _mm256_set1_epi32(K);
+
+    // [3 2 1 0] -> [3 1 2 0]
+    constexpr uint8_t REORDER_LANE_MASK = 0b11011000;
+
+    for (int i = 0; i < M; i++) {
+        __m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m256 a1 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[i*K+4]));
+        a0 = _mm256_mul_ps(a0, a0);
+        a1 = _mm256_mul_ps(a1, a1);
+        // [0 1 4 5 | 2 3 6 7] -> [0 1 2 3 | 4 5 6 7]
+        __m256 b0 = _mm256_hadd_ps(a0, a1);
+        b0 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(b0), REORDER_LANE_MASK));
+        if (!is_squared) {
+            b0 = _mm256_sqrt_ps(b0);
+        }
+        b0 = _mm256_mul_ps(b0, v_scale);
+        _mm256_storeu_ps(&y[i*K], b0);
+        v_sum = _mm256_add_ps(v_sum, b0);
+
+        __m256 mask = _mm256_cmp_ps(b0, v_max, _CMP_GT_OQ);
+        v_max = _mm256_blendv_ps(v_max, b0, mask);
+        v_max_index = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(v_max_index), _mm256_castsi256_ps(v_index), mask));
+        v_index = _mm256_add_epi32(v_index, v_index_step);
+    }
+
+    alignas(32) float lane_sum[K];
+    alignas(32) float lane_max[K];
+    alignas(32) int lane_index[K];
+    _mm256_store_ps(lane_sum, v_sum);
+    _mm256_store_ps(lane_max, v_max);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        sum += lane_sum[i];
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    c32_vec_mag_argmax_scalar(
+        &x[N_vector], &y[N_vector], N_remain, index_offset+N_vector,
+        scale, is_squared, peak_index, peak_value, sum);
+}
+#endif
+
+#if defined(_DSP_AVX512)
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX512
+void f32_vec_argmax_avx512(
+    const float* x, const int N_runtime, const int index_offset,
+    int& peak_index, float& peak_value)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 512bits = 64bytes = 16*4bytes
+    constexpr int K = 16;
+    const int M = (N+K-1)/K;
+
+    __m512 v_max = _mm512_set1_ps(peak_value);
+    __m512i v_max_index = _mm512_set1_epi32(peak_index);
+    __m512i v_index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    v_index = _mm512_add_epi32(v_index, _mm512_set1_epi32(index_offset));
+    const __m512i v_index_step = _mm512_set1_epi32(K);
+
+    // The last iteration is masked so lanes past the end can't be picked
+    for (int i = 0; i < M; i++) {
+        const int N_block = std::min(K, N-i*K);
+        const __mmask16 mask_load = __mmask16((1u << N_block) - 1u);
+        __m512 a0 = _mm512_maskz_loadu_ps(mask_load, &x[i*K]);
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(mask_load, a0, v_max, _CMP_GT_OQ);
+        v_max = _mm512_mask_mov_ps(v_max, mask, a0);
+        v_max_index = _mm512_mask_mov_epi32(v_max_index, mask, v_index);
+        v_index = _mm512_add_epi32(v_index, v_index_step);
+    }
+
+    // Pick the largest lane, and the earliest index if there is a tie
+    alignas(64) float lane_max[K];
+    alignas(64) int lane_index[K];
+    _mm512_store_ps(lane_max, v_max);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+}
+
+template <int N_FIXED=0>
+static DSP_FORCE_INLINE DSP_TARGET_AVX512
+void c32_vec_mag_argmax_avx512(
+    const std::complex<float>* x, float* y, const int N_runtime, const int index_offset,
+    const float scale, const bool is_squared,
+    int& peak_index, float& peak_value, float& sum)
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 2*512bits = 16 complex floats = 16 magnitudes
+    constexpr int K = 16;
+    const int M = (N+K-1)/K;
+
+    const __m512 v_scale = _mm512_set1_ps(scale);
+    __m512 v_sum = _mm512_setzero_ps();
+    __m512 v_max = _mm512_set1_ps(peak_value);
+    __m512i v_max_index = _mm512_set1_epi32(peak_index);
+    __m512i v_index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    v_index = _mm512_add_epi32(v_index, _mm512_set1_epi32(index_offset));
+    const __m512i v_index_step = _mm512_set1_epi32(K);
+
+    // The last iteration is masked so lanes past the end can't be picked
+    // NOTE: Masked out lanes are loaded as zero so they don't change the sum
+    for (int i = 0; i < M; i++) {
+        const int N_block = std::min(K, N-i*K);
+        const int N_lo = std::min(N_block, K/2);
+        const int N_hi = N_block-N_lo;
+        const __mmask16 mask_lo = __mmask16((1u << (2*N_lo)) - 1u);
+        const __mmask16 mask_hi = __mmask16((1u << (2*N_hi)) - 1u);
+        const __mmask16 mask_store = __mmask16((1u << N_block) - 1u);
+
+        __m512 a0 = _mm512_maskz_loadu_ps(mask_lo, reinterpret_cast<const float*>(&x[i*K]));
+        __m512 a1 = _mm512_maskz_loadu_ps(mask_hi, reinterpret_cast<const float*>(&x[i*K+8]));
+        __m512 b0 = c32_mag_squared_avx512(a0, a1);
+        if (!is_squared) {
+            // NOTE: The masked sqrt avoids gcc warning about the uninitialised source of _mm512_sqrt_ps
+            b0 = _mm512_mask_sqrt_ps(b0, 0xFFFF, b0);
+        }
+        b0 = _mm512_mul_ps(b0, v_scale);
+        _mm512_mask_storeu_ps(&y[i*K], mask_store, b0);
+        v_sum = _mm512_add_ps(v_sum, b0);
+
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(mask_store, b0, v_max, _CMP_GT_OQ);
+        v_max = _mm512_mask_mov_ps(v_max, mask, b0);
+        v_max_index = _mm512_mask_mov_epi32(v_max_index, mask, v_index);
+        v_index = _mm512_add_epi32(v_index, v_index_step);
+    }
+
+    alignas(64) float lane_sum[K];
+    alignas(64) float lane_max[K];
+    alignas(64) int lane_index[K];
+    _mm512_store_ps(lane_sum, v_sum);
+    _mm512_store_ps(lane_max, v_max);
+    _mm512_store_si512(reinterpret_cast<__m512i*>(lane_index), v_max_index);
+    for (int i = 0; i < K; i++) {
+        sum += lane_sum[i];
+        if ((lane_max[i] > peak_value) || ((lane_max[i] == peak_value) && (lane_index[i] < peak_index))) {
+            peak_value = lane_max[i];
+            peak_index = lane_index[i];
+        }
+    }
+}
+#endif
+
+template <int N_FIXED=0>
+inline static
+void f32_vec_argmax_auto(
+    const float* x, const int N, const int index_offset,
+    int& peak_index, float& peak_value)
+{
+    assert((N_FIXED == 0) || (N == N_FIXED));
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(
+        &f32_vec_argmax_avx512<N_FIXED>, &f32_vec_argmax_avx2<N_FIXED>, 
+        &f32_vec_argmax_ssse3<N_FIXED>, &f32_vec_argmax_scalar);
+    return kernel(x, N, index_offset, peak_index, peak_value);
+    #elif defined(_DSP_AVX512)
+    return f32_vec_argmax_avx512<N_FIXED>(x, N, index_offset, peak_index, peak_value);
+    #elif defined(_DSP_AVX2)
+    return f32_vec_argmax_avx2<N_FIXED>(x, N, index_offset, peak_index, peak_value);
+    #elif defined(_DSP_SSSE3)
+    return f32_vec_argmax_ssse3<N_FIXED>(x, N, index_offset, peak_index, peak_value);
+    #else
+    return f32_vec_argmax_scalar(x, N, index_offset, peak_index, peak_value);
+    #endif
+}
+
+template <int N_FIXED=0>
+static DSP_FORCE_INLINE
+void c32_vec_mag_argmax_auto(
+    const std::complex<float>* x, float* y, const int N, const int index_offset,
+    const float scale, const bool is_squared,
+    int& peak_index, float& peak_value, float& sum)
+{
+    assert((N_FIXED == 0) || (N == N_FIXED));
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(
+        &c32_vec_mag_argmax_avx512<N_FIXED>, &c32_vec_mag_argmax_avx2<N_FIXED>, 
+        &c32_vec_mag_argmax_ssse3<N_FIXED>, &c32_vec_mag_argmax_scalar);
+    return kernel(x, y, N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+    #elif defined(_DSP_AVX512)
+    return c32_vec_mag_argmax_avx512<N_FIXED>(x, y, N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+    #elif defined(_DSP_AVX2)
+    return c32_vec_mag_argmax_avx2<N_FIXED>(x, y, N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+    #elif defined(_DSP_SSSE3)
+    return c32_vec_mag_argmax_ssse3<N_FIXED>(x, y, N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+    #else
+    return c32_vec_mag_argmax_scalar(x, y, N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+    #endif
+}
+
+// Find the largest value outside of the circular exclusion zone [peak-exclusion, peak+exclusion]
+inline static
+void f32_vec_second_peak_auto(const float* x, const int N, const int exclusion, vec_peak_t& peak) {
+    peak.second_index = 0;
+    peak.second_value = 0.0f;
+    const int N_search = N - (2*exclusion+1);
+    if (N_search <= 0) {
+        return;
+    }
+    // The search region is a single circular range starting after the exclusion zone
+    const int start = (((peak.index+exclusion+1) % N) + N) % N;
+    const int N_head = (start+N_search > N) ? (N-start) : N_search;
+    const int N_tail = N_search-N_head;
+    int second_index = start;
+    float second_value = x[start];
+    f32_vec_argmax_auto(&x[start], N_head, start, second_index, second_value);
+    f32_vec_argmax_auto(&x[0], N_tail, 0, second_index, second_value);
+    peak.second_index = second_index;
+    peak.second_value = second_value;
+}
+
+// Magnitude of x scaled by scale, or squared magnitude if is_squared, with peak statistics
+template <int N_FIXED=0>
+static DSP_FORCE_INLINE
+vec_peak_t c32_vec_mag_peak_auto(
+    const std::complex<float>* x, float* y, const int N,
+    const float scale, const bool is_squared, const int exclusion)
+{
+    assert(N > 0);
+    vec_peak_t peak;
+    peak.index = 0;
+    peak.value = -1.0f;
+    float sum = 0.0f;
+    c32_vec_mag_argmax_auto<N_FIXED>(x, y, N, 0, scale, is_squared, peak.index, peak.value, sum);
+    peak.mean = sum / (float)N;
+    f32_vec_second_peak_auto(y, N, exclusion, peak);
+    return peak;
+}
+
+// Peak statistics of a vector of floats
+template <int N_FIXED=0>
+inline static
+vec_peak_t f32_vec_peak_auto(const float* x, const int N, const int exclusion) {
+    assert(N > 0);
+    vec_peak_t peak;
+    peak.index = 0;
+    peak.value = x[0];
+    f32_vec_argmax_auto<N_FIXED>(x, N, 0, peak.index, peak.value);
+    float sum = 0.0f;
+    for (int i = 0; i < N; i++) {
+        sum += x[i];
+    }
+    peak.mean = sum / (float)N;
+    f32_vec_second_peak_auto(x, N, exclusion, peak);
+    return peak;
+}
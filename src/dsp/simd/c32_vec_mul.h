@@ -1,9 +1,10 @@
 #pragma once
 #include <assert.h>
+#include <algorithm>
 #include <complex>
 
-// NOTE: Assumes arrays are aligned
-// Multiply and accumulate vector of complex floats with vector of floats
+// Multiply vector of complex floats with vector of complex floats
+// NOTE: Arrays do not need to be aligned so we can multiply rotated spectrums
 
 static inline
 void c32_vec_mul_scalar(
@@ -13,33 +14,36 @@ void c32_vec_mul_scalar(
     const int N) 
 {
     for (int i = 0; i < N; i++) {
-        y[i] += x0[i] * x1[i];
+        y[i] = x0[i] * x1[i];
     }
 }
 
 // TODO: Modify code to support ARM platforms like Raspberry PI using NEON
 #include <immintrin.h>
 #include "simd_config.h"
+#include "cpu_features.h"
 #include "data_packing.h"
 #include "c32_mul.h"
 
 #if defined(_DSP_SSSE3)
-static inline
+template <int N_FIXED=0>
+static inline DSP_TARGET_SSSE3
 void c32_vec_mul_ssse3(
     const std::complex<float>* x0, 
     const std::complex<float>* x1, 
     std::complex<float>* y, 
-    const int N) 
+    const int N_runtime) 
 {
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
     // 128bits = 16bytes = 2*8bytes
     constexpr int K = 2;
     const int M = N/K;
 
     for (int i = 0; i < M; i++) {
-        __m128 a0 = _mm_load_ps(reinterpret_cast<const float*>(&x0[i*K]));
-        __m128 a1 = _mm_load_ps(reinterpret_cast<const float*>(&x1[i*K]));
+        __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(&x0[i*K]));
+        __m128 a1 = _mm_loadu_ps(reinterpret_cast<const float*>(&x1[i*K]));
         __m128 b1 = c32_mul_ssse3(a0, a1);
-        _mm_store_ps(reinterpret_cast<float*>(&y[i*K]), b1);
+        _mm_storeu_ps(reinterpret_cast<float*>(&y[i*K]), b1);
     }
 
     const int N_vector = M*K;
@@ -49,22 +53,24 @@ void c32_vec_mul_ssse3(
 #endif
 
 #if defined(_DSP_AVX2)
-static inline
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX2
 void c32_vec_mul_avx2(
     const std::complex<float>* x0, 
     const std::complex<float>* x1, 
     std::complex<float>* y, 
-    const int N) 
+    const int N_runtime) 
 {
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
     // 256bits = 32bytes = 4*8bytes
     constexpr int K = 4;
     const int M = N/K;
 
     for (int i = 0; i < M; i++) {
-        __m256 a0 = _mm256_load_ps(reinterpret_cast<const float*>(&x0[i*K]));
-        __m256 a1 = _mm256_load_ps(reinterpret_cast<const float*>(&x1[i*K]));
+        __m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x0[i*K]));
+        __m256 a1 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x1[i*K]));
         __m256 b1 = c32_mul_avx2(a0, a1);
-        _mm256_store_ps(reinterpret_cast<float*>(&y[i*K]), b1);
+        _mm256_storeu_ps(reinterpret_cast<float*>(&y[i*K]), b1);
     }
 
     const int N_vector = M*K;
@@ -73,6 +79,41 @@ void c32_vec_mul_avx2(
 }
 #endif
 
+#if defined(_DSP_AVX512)
+template <int N_FIXED=0>
+static inline DSP_TARGET_AVX512
+void c32_vec_mul_avx512(
+    const std::complex<float>* x0, 
+    const std::complex<float>* x1, 
+    std::complex<float>* y, 
+    const int N_runtime) 
+{
+    const int N = (N_FIXED > 0) ? N_FIXED : N_runtime;
+    // 512bits = 64bytes = 8*8bytes
+    constexpr int K = 8;
+    const int M = N/K;
+
+    for (int i = 0; i < M; i++) {
+        __m512 a0 = _mm512_loadu_ps(reinterpret_cast<const float*>(&x0[i*K]));
+        __m512 a1 = _mm512_loadu_ps(reinterpret_cast<const float*>(&x1[i*K]));
+        __m512 b1 = c32_mul_avx512(a0, a1);
+        _mm512_storeu_ps(reinterpret_cast<float*>(&y[i*K]), b1);
+    }
+
+    // Masked loads and stores for the tail instead of a scalar loop
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    if (N_remain > 0) {
+        const __mmask16 mask = __mmask16((1u << (2*N_remain)) - 1u);
+        __m512 a0 = _mm512_maskz_loadu_ps(mask, reinterpret_cast<const float*>(&x0[N_vector]));
+        __m512 a1 = _mm512_maskz_loadu_ps(mask, reinterpret_cast<const float*>(&x1[N_vector]));
+        __m512 b1 = c32_mul_avx512(a0, a1);
+        _mm512_mask_storeu_ps(reinterpret_cast<float*>(&y[N_vector]), mask, b1);
+    }
+}
+#endif
+
+template <int N_FIXED=0>
 inline static 
 void c32_vec_mul_auto(
     const std::complex<float>* x0, 
@@ -80,11 +121,80 @@ void c32_vec_mul_auto(
     std::complex<float>* y, 
     const int N) 
 {
-    #if defined(_DSP_AVX2)
-    return c32_vec_mul_avx2(x0, x1, y, N);
+    assert((N_FIXED == 0) || (N == N_FIXED));
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(
+        &c32_vec_mul_avx512<N_FIXED>, &c32_vec_mul_avx2<N_FIXED>, 
+        &c32_vec_mul_ssse3<N_FIXED>, &c32_vec_mul_scalar);
+    return kernel(x0, x1, y, N);
+    #elif defined(_DSP_AVX512)
+    return c32_vec_mul_avx512<N_FIXED>(x0, x1, y, N);
+    #elif defined(_DSP_AVX2)
+    return c32_vec_mul_avx2<N_FIXED>(x0, x1, y, N);
     #elif defined(_DSP_SSSE3)
-    return c32_vec_mul_ssse3(x0, x1, y, N);
+    return c32_vec_mul_ssse3<N_FIXED>(x0, x1, y, N);
     #else
     return c32_vec_mul_scalar(x0, x1, y, N);
     #endif
 }
+
+// Many independent multiplies y[i] = x0[i]*x1[i] of the same length
+// x1 continues from x1_wrap at x1_wrap_index if it is set, e.g. a rotation of a spectrum that is only stored once
+struct c32_vec_mul_task_t {
+    const std::complex<float>* x0;
+    const std::complex<float>* x1;
+    std::complex<float>* y;
+    const std::complex<float>* x1_wrap = nullptr;
+    int x1_wrap_index = 0;
+};
+
+// 512 complex floats = 4kB per operand so the tiles of shared operands stay in L1 cache
+constexpr int C32_VEC_MUL_TILE_SIZE = 512;
+
+// Multiply the tile [i, i+N_tile) of a task where only the tile that crosses the wrap of x1 is split in two
+template <int N_TILE_FIXED>
+inline static
+void c32_vec_mul_task_tile(const c32_vec_mul_task_t& task, const int i, const int N_tile) {
+    const int i_wrap = task.x1_wrap_index;
+    if ((task.x1_wrap == nullptr) || (i+N_tile <= i_wrap)) {
+        c32_vec_mul_auto<N_TILE_FIXED>(&task.x0[i], &task.x1[i], &task.y[i], N_tile);
+    } else if (i >= i_wrap) {
+        c32_vec_mul_auto<N_TILE_FIXED>(&task.x0[i], &task.x1_wrap[i-i_wrap], &task.y[i], N_tile);
+    } else {
+        const int N_head = i_wrap-i;
+        c32_vec_mul_auto(&task.x0[i], &task.x1[i], &task.y[i], N_head);
+        c32_vec_mul_auto(&task.x0[i_wrap], task.x1_wrap, &task.y[i_wrap], N_tile-N_head);
+    }
+}
+
+// Perform every task one tile at a time instead of one task at a time
+// Operands that are shared between tasks, e.g. an input spectrum multiplied against many templates, 
+// are read from memory once per tile and from L1 cache for the remaining tasks
+// NOTE: Operands can overlap between tasks like the rotations of a doubled spectrum
+//       With a compile time size N_FIXED that is a multiple of the tile size every tile has a fixed size
+template <int N_FIXED=0>
+inline static
+void c32_vec_mul_tiled_auto(
+    const c32_vec_mul_task_t* tasks, 
+    const int total_tasks,
+    const int N,
+    const int tile_size=C32_VEC_MUL_TILE_SIZE)
+{
+    assert(tile_size > 0);
+    assert((N_FIXED == 0) || (N == N_FIXED));
+    constexpr int TILE_FIXED = ((N_FIXED > 0) && (N_FIXED % C32_VEC_MUL_TILE_SIZE == 0)) ? C32_VEC_MUL_TILE_SIZE : 0;
+    if ((TILE_FIXED > 0) && (tile_size == TILE_FIXED)) {
+        for (int i = 0; i < N; i += TILE_FIXED) {
+            for (int j = 0; j < total_tasks; j++) {
+                c32_vec_mul_task_tile<TILE_FIXED>(tasks[j], i, TILE_FIXED);
+            }
+        }
+        return;
+    }
+    for (int i = 0; i < N; i += tile_size) {
+        const int N_tile = std::min(tile_size, N-i);
+        for (int j = 0; j < total_tasks; j++) {
+            c32_vec_mul_task_tile<0>(tasks[j], i, N_tile);
+        }
+    }
+}
@@ -0,0 +1,240 @@
+#pragma once
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+// Numerically controlled oscillator
+// c32_vec_oscillator: y[i] = e^(j*(phase + step*i))
+// c32_vec_mix_oscillator: y[i] = x[i]*e^(j*(phase + step*i))
+// Each lane is rotated by a phasor recurrence instead of evaluating sin and cos per sample
+// NOTE: Lanes are reseeded from the exact phase every OSCILLATOR_RESEED_SIZE samples
+//       so rounding errors in the recurrence can't build up in magnitude or phase
+
+constexpr int OSCILLATOR_RESEED_SIZE = 256;
+
+static inline
+std::complex<float> c32_oscillator_phasor(const float phase, const float step, const int i) {
+    // Evaluate in double precision since step*i loses precision in float for large i
+    constexpr double TWO_PI = 2.0*3.14159265358979323846;
+    const double dt = std::fmod(double(phase) + double(step)*double(i), TWO_PI);
+    return std::complex<float>(float(std::cos(dt)), float(std::sin(dt)));
+}
+
+static inline
+void c32_vec_mix_oscillator_scalar(
+    const std::complex<float>* x,
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    const auto rotate = c32_oscillator_phasor(0.0f, step, 1);
+    for (int i0 = 0; i0 < N; i0 += OSCILLATOR_RESEED_SIZE) {
+        const int M = std::min(OSCILLATOR_RESEED_SIZE, N-i0);
+        auto osc = c32_oscillator_phasor(phase, step, i0);
+        for (int i = i0; i < (i0+M); i++) {
+            y[i] = x[i]*osc;
+            osc = osc*rotate;
+        }
+    }
+}
+
+static inline
+void c32_vec_oscillator_scalar(
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    const auto rotate = c32_oscillator_phasor(0.0f, step, 1);
+    for (int i0 = 0; i0 < N; i0 += OSCILLATOR_RESEED_SIZE) {
+        const int M = std::min(OSCILLATOR_RESEED_SIZE, N-i0);
+        auto osc = c32_oscillator_phasor(phase, step, i0);
+        for (int i = i0; i < (i0+M); i++) {
+            y[i] = osc;
+            osc = osc*rotate;
+        }
+    }
+}
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "simd_config.h"
+#include "cpu_features.h"
+#include "c32_mul.h"
+
+#if defined(_DSP_SSSE3)
+static inline DSP_TARGET_SSSE3
+__m128 c32_oscillator_seed_ssse3(const float phase, const float step, const int i) {
+    alignas(16) std::complex<float> seed[2];
+    for (int k = 0; k < 2; k++) {
+        seed[k] = c32_oscillator_phasor(phase, step, i+k);
+    }
+    return _mm_load_ps(reinterpret_cast<const float*>(seed));
+}
+
+static inline DSP_TARGET_SSSE3
+void c32_vec_mix_oscillator_ssse3(
+    const std::complex<float>* x,
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    // 128bits = 16bytes = 2*8bytes
+    constexpr int K = 2;
+    const int M = N/K;
+    constexpr int M_RESEED = OSCILLATOR_RESEED_SIZE/K;
+
+    const auto rotate_K = c32_oscillator_phasor(0.0f, step, K);
+    const __m128 rotate = _mm_setr_ps(rotate_K.real(), rotate_K.imag(), rotate_K.real(), rotate_K.imag());
+    __m128 osc = _mm_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        if ((i % M_RESEED) == 0) {
+            osc = c32_oscillator_seed_ssse3(phase, step, i*K);
+        }
+        __m128 a0 = _mm_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m128 b0 = c32_mul_ssse3(a0, osc);
+        _mm_storeu_ps(reinterpret_cast<float*>(&y[i*K]), b0);
+        osc = c32_mul_ssse3(osc, rotate);
+    }
+
+    const int N_vector = M*K;
+    for (int i = N_vector; i < N; i++) {
+        y[i] = x[i]*c32_oscillator_phasor(phase, step, i);
+    }
+}
+
+static inline DSP_TARGET_SSSE3
+void c32_vec_oscillator_ssse3(
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    // 128bits = 16bytes = 2*8bytes
+    constexpr int K = 2;
+    const int M = N/K;
+    constexpr int M_RESEED = OSCILLATOR_RESEED_SIZE/K;
+
+    const auto rotate_K = c32_oscillator_phasor(0.0f, step, K);
+    const __m128 rotate = _mm_setr_ps(rotate_K.real(), rotate_K.imag(), rotate_K.real(), rotate_K.imag());
+    __m128 osc = _mm_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        if ((i % M_RESEED) == 0) {
+            osc = c32_oscillator_seed_ssse3(phase, step, i*K);
+        }
+        _mm_storeu_ps(reinterpret_cast<float*>(&y[i*K]), osc);
+        osc = c32_mul_ssse3(osc, rotate);
+    }
+
+    const int N_vector = M*K;
+    for (int i = N_vector; i < N; i++) {
+        y[i] = c32_oscillator_phasor(phase, step, i);
+    }
+}
+#endif
+
+#if defined(_DSP_AVX2)
+static inline DSP_TARGET_AVX2
+__m256 c32_oscillator_seed_avx2(const float phase, const float step, const int i) {
+    alignas(32) std::complex<float> seed[4];
+    for (int k = 0; k < 4; k++) {
+        seed[k] = c32_oscillator_phasor(phase, step, i+k);
+    }
+    return _mm256_load_ps(reinterpret_cast<const float*>(seed));
+}
+
+static inline DSP_TARGET_AVX2
+void c32_vec_mix_oscillator_avx2(
+    const std::complex<float>* x,
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    // 256bits = 32bytes = 4*8bytes
+    constexpr int K = 4;
+    const int M = N/K;
+    constexpr int M_RESEED = OSCILLATOR_RESEED_SIZE/K;
+
+    const auto rotate_K = c32_oscillator_phasor(0.0f, step, K);
+    const __m256 rotate = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&rotate_K)));
+    __m256 osc = _mm256_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        if ((i % M_RESEED) == 0) {
+            osc = c32_oscillator_seed_avx2(phase, step, i*K);
+        }
+        __m256 a0 = _mm256_loadu_ps(reinterpret_cast<const float*>(&x[i*K]));
+        __m256 b0 = c32_mul_avx2(a0, osc);
+        _mm256_storeu_ps(reinterpret_cast<float*>(&y[i*K]), b0);
+        osc = c32_mul_avx2(osc, rotate);
+    }
+
+    const int N_vector = M*K;
+    for (int i = N_vector; i < N; i++) {
+        y[i] = x[i]*c32_oscillator_phasor(phase, step, i);
+    }
+}
+
+static inline DSP_TARGET_AVX2
+void c32_vec_oscillator_avx2(
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    // 256bits = 32bytes = 4*8bytes
+    constexpr int K = 4;
+    const int M = N/K;
+    constexpr int M_RESEED = OSCILLATOR_RESEED_SIZE/K;
+
+    const auto rotate_K = c32_oscillator_phasor(0.0f, step, K);
+    const __m256 rotate = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&rotate_K)));
+    __m256 osc = _mm256_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        if ((i % M_RESEED) == 0) {
+            osc = c32_oscillator_seed_avx2(phase, step, i*K);
+        }
+        _mm256_storeu_ps(reinterpret_cast<float*>(&y[i*K]), osc);
+        osc = c32_mul_avx2(osc, rotate);
+    }
+
+    const int N_vector = M*K;
+    for (int i = N_vector; i < N; i++) {
+        y[i] = c32_oscillator_phasor(phase, step, i);
+    }
+}
+#endif
+
+inline static
+void c32_vec_mix_oscillator_auto(
+    const std::complex<float>* x,
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&c32_vec_mix_oscillator_avx2, &c32_vec_mix_oscillator_ssse3, &c32_vec_mix_oscillator_scalar);
+    return kernel(x, y, phase, step, N);
+    #elif defined(_DSP_AVX2)
+    return c32_vec_mix_oscillator_avx2(x, y, phase, step, N);
+    #elif defined(_DSP_SSSE3)
+    return c32_vec_mix_oscillator_ssse3(x, y, phase, step, N);
+    #else
+    return c32_vec_mix_oscillator_scalar(x, y, phase, step, N);
+    #endif
+}
+
+inline static
+void c32_vec_oscillator_auto(
+    std::complex<float>* y,
+    const float phase, const float step,
+    const int N)
+{
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&c32_vec_oscillator_avx2, &c32_vec_oscillator_ssse3, &c32_vec_oscillator_scalar);
+    return kernel(y, phase, step, N);
+    #elif defined(_DSP_AVX2)
+    return c32_vec_oscillator_avx2(y, phase, step, N);
+    #elif defined(_DSP_SSSE3)
+    return c32_vec_oscillator_ssse3(y, phase, step, N);
+    #else
+    return c32_vec_oscillator_scalar(y, phase, step, N);
+    #endif
+}
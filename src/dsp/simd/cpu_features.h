@@ -0,0 +1,111 @@
+#pragma once
+#include "simd_config.h"
+
+// Instruction sets that kernels are written for in increasing order
+enum class DSP_SIMD_Level {
+    SCALAR = 0,
+    SSSE3 = 1,
+    // AVX2 with FMA
+    AVX2 = 2,
+    // AVX512F
+    AVX512 = 3,
+};
+
+#if defined(_DSP_RUNTIME_DISPATCH)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+
+static inline
+DSP_SIMD_Level dsp_detect_simd_level() {
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool is_ssse3 = (info[2] & (1 << 9)) != 0;
+    const bool is_fma = (info[2] & (1 << 12)) != 0;
+    const bool is_osxsave = (info[2] & (1 << 27)) != 0;
+    const bool is_avx = (info[2] & (1 << 28)) != 0;
+    bool is_avx2 = false;
+    bool is_avx512f = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        is_avx2 = (info[1] & (1 << 5)) != 0;
+        is_avx512f = (info[1] & (1 << 16)) != 0;
+    }
+    // The os has to save the upper halves of the ymm registers on a context switch
+    const unsigned long long xcr0 = is_osxsave ? _xgetbv(0) : 0;
+    const bool is_ymm_enabled = (xcr0 & 0b110) == 0b110;
+    // As well as the opmask and zmm registers for avx512
+    const bool is_zmm_enabled = (xcr0 & 0b11100110) == 0b11100110;
+    const bool is_avx2_usable = is_avx && is_avx2 && is_fma && is_ymm_enabled;
+    if (is_avx2_usable && is_avx512f && is_zmm_enabled) return DSP_SIMD_Level::AVX512;
+    if (is_avx2_usable) return DSP_SIMD_Level::AVX2;
+    if (is_ssse3) return DSP_SIMD_Level::SSSE3;
+    return DSP_SIMD_Level::SCALAR;
+}
+#else
+static inline
+DSP_SIMD_Level dsp_detect_simd_level() {
+    // NOTE: This also checks that the os saves the ymm and zmm registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return DSP_SIMD_Level::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return DSP_SIMD_Level::AVX2;
+    if (__builtin_cpu_supports("ssse3")) return DSP_SIMD_Level::SSSE3;
+    return DSP_SIMD_Level::SCALAR;
+}
+#endif
+#else
+// Without runtime dispatch the program can only run on cpus it was compiled for
+static inline
+DSP_SIMD_Level dsp_detect_simd_level() {
+    #if defined(_DSP_AVX512)
+    return DSP_SIMD_Level::AVX512;
+    #elif defined(_DSP_AVX2)
+    return DSP_SIMD_Level::AVX2;
+    #elif defined(_DSP_SSSE3)
+    return DSP_SIMD_Level::SSSE3;
+    #else
+    return DSP_SIMD_Level::SCALAR;
+    #endif
+}
+#endif
+
+// Detected once for the whole program
+inline DSP_SIMD_Level dsp_get_simd_level() {
+    static const DSP_SIMD_Level level = dsp_detect_simd_level();
+    return level;
+}
+
+inline const char* dsp_get_simd_level_name(const DSP_SIMD_Level level) {
+    switch (level) {
+    case DSP_SIMD_Level::SCALAR:    return "scalar";
+    case DSP_SIMD_Level::SSSE3:     return "ssse3";
+    case DSP_SIMD_Level::AVX2:      return "avx2";
+    case DSP_SIMD_Level::AVX512:    return "avx512";
+    default:                        return "unknown";
+    }
+}
+
+// Pick the kernel for the detected instruction set
+// NOTE: Callers keep the result in a static so this only runs on the first call
+template <typename F>
+static inline
+F dsp_select_kernel(F avx2, F ssse3, F scalar) {
+    switch (dsp_get_simd_level()) {
+    case DSP_SIMD_Level::AVX512:
+    case DSP_SIMD_Level::AVX2:  return avx2;
+    case DSP_SIMD_Level::SSSE3: return ssse3;
+    default:                    return scalar;
+    }
+}
+
+// For kernels that also have an avx512 version
+template <typename F>
+static inline
+F dsp_select_kernel(F avx512, F avx2, F ssse3, F scalar) {
+    if (dsp_get_simd_level() >= DSP_SIMD_Level::AVX512) return avx512;
+    return dsp_select_kernel(avx2, ssse3, scalar);
+}
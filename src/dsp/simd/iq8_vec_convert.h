@@ -0,0 +1,309 @@
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <complex>
+
+// Convert 8bit IQ samples to complex floats with a fused offset and scale
+// y[i] = (x[i] - offset)*scale
+// Returns sum(x[i] - offset) so the caller can track the remaining DC offset of I and Q
+// Also convert signed 8bit IQ samples to unsigned 8bit samples
+// y[i] = x[i] + 127
+// NOTE: Arrays do not need to be aligned
+
+static inline
+std::complex<float> cu8_to_c32_vec_convert_scalar(
+    const std::complex<uint8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    std::complex<float> sum = 0.0f;
+    for (int i = 0; i < N; i++) {
+        const auto v = std::complex<float>((float)x[i].real(), (float)x[i].imag()) - offset;
+        sum += v;
+        y[i] = v*scale;
+    }
+    return sum;
+}
+
+static inline
+std::complex<float> cs8_to_c32_vec_convert_scalar(
+    const std::complex<int8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    std::complex<float> sum = 0.0f;
+    for (int i = 0; i < N; i++) {
+        const auto v = std::complex<float>((float)x[i].real(), (float)x[i].imag()) - offset;
+        sum += v;
+        y[i] = v*scale;
+    }
+    return sum;
+}
+
+static inline
+void s8_to_u8_vec_convert_scalar(const int8_t* x, uint8_t* y, const int N) {
+    for (int i = 0; i < N; i++) {
+        y[i] = (uint8_t)((int)x[i] + 127);
+    }
+}
+
+// TODO: Modify code to support ARM platforms like Raspberry PI using NEON
+#include <immintrin.h>
+#include "simd_config.h"
+#include "cpu_features.h"
+#include "data_packing.h"
+
+#if defined(_DSP_SSSE3)
+// Sum [I Q I Q] lanes into a single IQ value
+static inline DSP_TARGET_SSSE3
+std::complex<float> c32_hsum_ssse3(__m128 x) {
+    cpx128_t res;
+    res.ps = x;
+    return res.c32[0] + res.c32[1];
+}
+
+// NOTE: SSE4.1 has sign and zero extending conversions but SSSE3 needs to unpack
+//       16 bytes -> 4x4 int32
+static inline DSP_TARGET_SSSE3
+void u8_widen_ssse3(__m128i x, __m128i (&y)[4]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_unpacklo_epi8(x, zero);
+    const __m128i hi = _mm_unpackhi_epi8(x, zero);
+    y[0] = _mm_unpacklo_epi16(lo, zero);
+    y[1] = _mm_unpackhi_epi16(lo, zero);
+    y[2] = _mm_unpacklo_epi16(hi, zero);
+    y[3] = _mm_unpackhi_epi16(hi, zero);
+}
+
+static inline DSP_TARGET_SSSE3
+void s8_widen_ssse3(__m128i x, __m128i (&y)[4]) {
+    // Place each byte in the upper half of the wider lane then arithmetic shift it down
+    const __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+    const __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+    y[0] = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+    y[1] = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+    y[2] = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+    y[3] = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+}
+
+template <bool IS_SIGNED>
+static inline DSP_TARGET_SSSE3
+std::complex<float> c8_to_c32_vec_convert_ssse3(
+    const uint8_t* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    // 128bits = 16bytes = 8*2bytes
+    constexpr int K = 8;
+    const int M = N/K;
+
+    const __m128 v_offset = _mm_setr_ps(offset.real(), offset.imag(), offset.real(), offset.imag());
+    const __m128 v_scale = _mm_set1_ps(scale);
+    __m128 v_sum = _mm_setzero_ps();
+    __m128i a[4];
+    for (int i = 0; i < M; i++) {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&x[i*K*2]));
+        if (IS_SIGNED) {
+            s8_widen_ssse3(raw, a);
+        } else {
+            u8_widen_ssse3(raw, a);
+        }
+        for (int j = 0; j < 4; j++) {
+            __m128 b0 = _mm_sub_ps(_mm_cvtepi32_ps(a[j]), v_offset);
+            v_sum = _mm_add_ps(v_sum, b0);
+            _mm_storeu_ps(reinterpret_cast<float*>(&y[i*K + j*2]), _mm_mul_ps(b0, v_scale));
+        }
+    }
+    return c32_hsum_ssse3(v_sum);
+}
+
+static inline DSP_TARGET_SSSE3
+std::complex<float> cu8_to_c32_vec_convert_ssse3(
+    const std::complex<uint8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    constexpr int K = 8;
+    const int N_vector = (N/K)*K;
+    auto sum = c8_to_c32_vec_convert_ssse3<false>(reinterpret_cast<const uint8_t*>(x), y, N_vector, offset, scale);
+    sum += cu8_to_c32_vec_convert_scalar(&x[N_vector], &y[N_vector], N-N_vector, offset, scale);
+    return sum;
+}
+
+static inline DSP_TARGET_SSSE3
+std::complex<float> cs8_to_c32_vec_convert_ssse3(
+    const std::complex<int8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    constexpr int K = 8;
+    const int N_vector = (N/K)*K;
+    auto sum = c8_to_c32_vec_convert_ssse3<true>(reinterpret_cast<const uint8_t*>(x), y, N_vector, offset, scale);
+    sum += cs8_to_c32_vec_convert_scalar(&x[N_vector], &y[N_vector], N-N_vector, offset, scale);
+    return sum;
+}
+
+static inline DSP_TARGET_SSSE3
+void s8_to_u8_vec_convert_ssse3(const int8_t* x, uint8_t* y, const int N) {
+    // 128bits = 16bytes
+    constexpr int K = 16;
+    const int M = N/K;
+
+    const __m128i v_offset = _mm_set1_epi8(127);
+    for (int i = 0; i < M; i++) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&x[i*K]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&y[i*K]), _mm_add_epi8(a0, v_offset));
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    s8_to_u8_vec_convert_scalar(&x[N_vector], &y[N_vector], N_remain);
+}
+#endif
+
+#if defined(_DSP_AVX2)
+// Sum [I Q I Q I Q I Q] lanes into a single IQ value
+static inline DSP_TARGET_AVX2
+std::complex<float> c32_hsum_avx2(__m256 x) {
+    cpx256_t res;
+    res.ps = x;
+    return (res.c32[0] + res.c32[1]) + (res.c32[2] + res.c32[3]);
+}
+
+template <bool IS_SIGNED>
+static inline DSP_TARGET_AVX2
+std::complex<float> c8_to_c32_vec_convert_avx2(
+    const uint8_t* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    // 128bits = 16bytes = 8*2bytes which are widened into 2*256bits
+    constexpr int K = 8;
+    const int M = N/K;
+
+    const __m256 v_offset = _mm256_castpd_ps(_mm256_broadcast_sd(reinterpret_cast<const double*>(&offset)));
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    __m256 v_sum = _mm256_setzero_ps();
+    for (int i = 0; i < M; i++) {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&x[i*K*2]));
+        __m128i raw_hi = _mm_unpackhi_epi64(raw, raw);
+        __m256i a0, a1;
+        if (IS_SIGNED) {
+            a0 = _mm256_cvtepi8_epi32(raw);
+            a1 = _mm256_cvtepi8_epi32(raw_hi);
+        } else {
+            a0 = _mm256_cvtepu8_epi32(raw);
+            a1 = _mm256_cvtepu8_epi32(raw_hi);
+        }
+        __m256 b0 = _mm256_sub_ps(_mm256_cvtepi32_ps(a0), v_offset);
+        __m256 b1 = _mm256_sub_ps(_mm256_cvtepi32_ps(a1), v_offset);
+        v_sum = _mm256_add_ps(v_sum, _mm256_add_ps(b0, b1));
+        _mm256_storeu_ps(reinterpret_cast<float*>(&y[i*K]),   _mm256_mul_ps(b0, v_scale));
+        _mm256_storeu_ps(reinterpret_cast<float*>(&y[i*K+4]), _mm256_mul_ps(b1, v_scale));
+    }
+    return c32_hsum_avx2(v_sum);
+}
+
+static inline DSP_TARGET_AVX2
+std::complex<float> cu8_to_c32_vec_convert_avx2(
+    const std::complex<uint8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    constexpr int K = 8;
+    const int N_vector = (N/K)*K;
+    auto sum = c8_to_c32_vec_convert_avx2<false>(reinterpret_cast<const uint8_t*>(x), y, N_vector, offset, scale);
+    sum += cu8_to_c32_vec_convert_scalar(&x[N_vector], &y[N_vector], N-N_vector, offset, scale);
+    return sum;
+}
+
+static inline DSP_TARGET_AVX2
+std::complex<float> cs8_to_c32_vec_convert_avx2(
+    const std::complex<int8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    constexpr int K = 8;
+    const int N_vector = (N/K)*K;
+    auto sum = c8_to_c32_vec_convert_avx2<true>(reinterpret_cast<const uint8_t*>(x), y, N_vector, offset, scale);
+    sum += cs8_to_c32_vec_convert_scalar(&x[N_vector], &y[N_vector], N-N_vector, offset, scale);
+    return sum;
+}
+
+static inline DSP_TARGET_AVX2
+void s8_to_u8_vec_convert_avx2(const int8_t* x, uint8_t* y, const int N) {
+    // 256bits = 32bytes
+    constexpr int K = 32;
+    const int M = N/K;
+
+    const __m256i v_offset = _mm256_set1_epi8(127);
+    for (int i = 0; i < M; i++) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&x[i*K]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&y[i*K]), _mm256_add_epi8(a0, v_offset));
+    }
+
+    const int N_vector = M*K;
+    const int N_remain = N-N_vector;
+    s8_to_u8_vec_convert_scalar(&x[N_vector], &y[N_vector], N_remain);
+}
+#endif
+
+inline static
+std::complex<float> cu8_to_c32_vec_convert_auto(
+    const std::complex<uint8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&cu8_to_c32_vec_convert_avx2, &cu8_to_c32_vec_convert_ssse3, &cu8_to_c32_vec_convert_scalar);
+    return kernel(x, y, N, offset, scale);
+    #elif defined(_DSP_AVX2)
+    return cu8_to_c32_vec_convert_avx2(x, y, N, offset, scale);
+    #elif defined(_DSP_SSSE3)
+    return cu8_to_c32_vec_convert_ssse3(x, y, N, offset, scale);
+    #else
+    return cu8_to_c32_vec_convert_scalar(x, y, N, offset, scale);
+    #endif
+}
+
+inline static
+std::complex<float> cs8_to_c32_vec_convert_auto(
+    const std::complex<int8_t>* x,
+    std::complex<float>* y,
+    const int N,
+    const std::complex<float> offset, const float scale)
+{
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&cs8_to_c32_vec_convert_avx2, &cs8_to_c32_vec_convert_ssse3, &cs8_to_c32_vec_convert_scalar);
+    return kernel(x, y, N, offset, scale);
+    #elif defined(_DSP_AVX2)
+    return cs8_to_c32_vec_convert_avx2(x, y, N, offset, scale);
+    #elif defined(_DSP_SSSE3)
+    return cs8_to_c32_vec_convert_ssse3(x, y, N, offset, scale);
+    #else
+    return cs8_to_c32_vec_convert_scalar(x, y, N, offset, scale);
+    #endif
+}
+
+inline static
+void s8_to_u8_vec_convert_auto(const int8_t* x, uint8_t* y, const int N) {
+    #if defined(_DSP_RUNTIME_DISPATCH)
+    static const auto kernel = dsp_select_kernel(&s8_to_u8_vec_convert_avx2, &s8_to_u8_vec_convert_ssse3, &s8_to_u8_vec_convert_scalar);
+    return kernel(x, y, N);
+    #elif defined(_DSP_AVX2)
+    return s8_to_u8_vec_convert_avx2(x, y, N);
+    #elif defined(_DSP_SSSE3)
+    return s8_to_u8_vec_convert_ssse3(x, y, N);
+    #else
+    return s8_to_u8_vec_convert_scalar(x, y, N);
+    #endif
+}
@@ -1,6 +1,19 @@
 #pragma once
 
+// DSP_RUNTIME_DISPATCH compiles every kernel and picks the best one the cpu supports at runtime
+// Otherwise only the kernels that can be compiled on target are enabled
+#if defined(DSP_RUNTIME_DISPATCH) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define _DSP_RUNTIME_DISPATCH
+#define _DSP_AVX512
+#define _DSP_AVX2
+#define _DSP_SSSE3
+#define _DSP_FMA
+#else
 // Enable intrinsic code that can be compiled on target
+#if defined(__AVX512F__)
+#define _DSP_AVX512
+#endif
+
 #if defined(__AVX2__)
 #define _DSP_AVX2
 #endif
@@ -17,7 +30,40 @@
 #define _DSP_FMA
 #endif
 
-#if defined(_DSP_AVX2)
+// SSSE3 kernels only use FMA if the whole program is built for it
+// NOTE: With runtime dispatch they run on cpus that have SSSE3 but not FMA
+#if defined(_DSP_FMA)
+#define _DSP_SSSE3_FMA
+#endif
+#endif
+
+// With runtime dispatch GCC and Clang need kernels to be tagged with the instruction sets they use
+// MSVC lets intrinsics be used anywhere
+#if defined(_DSP_RUNTIME_DISPATCH) && !defined(_MSC_VER)
+#define DSP_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#define DSP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define DSP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define DSP_TARGET_AVX512
+#define DSP_TARGET_AVX2
+#define DSP_TARGET_SSSE3
+#endif
+
+// Force inlining so callers with a compile time size get fixed trip counts without scalar tails
+// NOTE: With runtime dispatch the kernels are called through a function pointer instead
+//       so kernels also take the compile time size as a template parameter N_FIXED, or 0 for the runtime size
+//       Each size has its own function pointer to a kernel with fixed trip counts
+#if defined(_MSC_VER)
+#define DSP_FORCE_INLINE __forceinline
+#else
+#define DSP_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+#if defined(_DSP_RUNTIME_DISPATCH)
+#pragma message("Compiling DSP SIMD with runtime dispatch of scalar, SSSE3, AVX2 and AVX512 code")
+#elif defined(_DSP_AVX512)
+#pragma message("Compiling DSP SIMD using AVX512 code")
+#elif defined(_DSP_AVX2)
 #pragma message("Compiling DSP SIMD using AVX2 code")
 #elif defined(_DSP_SSSE3)
 #pragma message("Compiling DSP SIMD using SSSE3 code")
@@ -27,4 +73,4 @@
 
 #if defined(_DSP_FMA)
 #pragma message("Compiling DSP SIMD with FMA code")
-#endif
\ No newline at end of file
+#endif
@@ -2,14 +2,48 @@
 #include "gps_prn_constants.h"
 #include "prn_code.h"
 #include "dsp/calculate_fft.h"
+#include "dsp/simd/c32_vec_mul.h"
+#include "dsp/simd/c32_vec_oscillator.h"
 #include <stdint.h>
 #include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
 
 // NOTE: AVX2 requires 256bit = 32byte alignment
 constexpr int SIMD_ALIGN_AMOUNT = 32;
 
-GPS_App::GPS_App(const int _Fs, const int _Fcode, const int _Fdev_max)
-: block_size(_Fs/_Fcode)
+// Acquisition is confirmed when the best frequency offset is consistently the mode 
+// and the correlation peak stands out from the second peak
+constexpr int ACQUISITION_MIN_COUNTS = 10;
+constexpr float ACQUISITION_MIN_MODE_FRACTION = 0.5f;
+constexpr float ACQUISITION_MIN_PEAK_RATIO = 2.0f;
+
+// Use a correlator specialised at compile time if there is one for this block size
+static std::unique_ptr<GPS_Correlator> CreateCorrelator(
+    tcb::span<uint8_t> prn_code, 
+    const int block_size, 
+    const int Fcode, const int Fs, const int Fdev_max,
+    const GPS_TemplateMode template_mode)
+{
+    const int total_freq_offsets = GPS_Correlator::GetTotalFrequencyOffsets(Fcode, Fdev_max);
+    if (total_freq_offsets == 25) {
+        switch (block_size) {
+        case 2048: return std::make_unique<GPS_CorrelatorFixed<2048,25>>(prn_code, block_size, Fcode, Fs, Fdev_max, template_mode);
+        case 4096: return std::make_unique<GPS_CorrelatorFixed<4096,25>>(prn_code, block_size, Fcode, Fs, Fdev_max, template_mode);
+        case 8192: return std::make_unique<GPS_CorrelatorFixed<8192,25>>(prn_code, block_size, Fcode, Fs, Fdev_max, template_mode);
+        default: break;
+        }
+    }
+    return std::make_unique<GPS_Correlator>(prn_code, block_size, Fcode, Fs, Fdev_max, template_mode);
+}
+
+GPS_App::GPS_App(
+    const int _Fs, const int _Fcode, const int _Fdev_max, 
+    const GPS_TemplateMode _template_mode,
+    const size_t _total_threads)
+: block_size(_Fs/_Fcode),
+  gps_correlator_thread_pool(_total_threads)
 {
     assert(block_size > 0);
     assert(_Fs > 0);
@@ -17,40 +51,537 @@ GPS_App::GPS_App(const int _Fs, const int _Fcode, const int _Fdev_max)
 
     auto prn_code = std::vector<uint8_t>(PRN_CODE_LENGTH);
     gps_correlators.reserve(TOTAL_PRN_CODES);
+    gps_trackers.reserve(TOTAL_PRN_CODES);
     gps_correlator_trigger_flags.resize(TOTAL_PRN_CODES, 0);
     for (int prn_id = 0; prn_id < TOTAL_PRN_CODES; prn_id++) {
         generate_prn_code<uint8_t>(prn_code, PRN_OUTPUT_TAPS[prn_id]);
-        auto corr = GPS_Correlator(prn_code, block_size, _Fcode, _Fs, _Fdev_max);
+        auto corr = CreateCorrelator(prn_code, block_size, _Fcode, _Fs, _Fdev_max, _template_mode);
         gps_correlators.push_back(std::move(corr));
+        gps_trackers.emplace_back(prn_code, block_size, _Fs);
+    }
+
+    fft_plan = FFT_Plan((size_t)block_size, false);
+    fft_batch_plan = FFT_BatchPlan((size_t)block_size, false);
+    ifft_batch_plan = FFT_BatchPlan((size_t)block_size, true);
+    const int coarse_block_size = gps_correlators[0]->GetCoarseBlockSize();
+    if (coarse_block_size > 0) {
+        coarse_ifft_batch_plan = FFT_BatchPlan((size_t)coarse_block_size, true);
     }
+    fold_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    fold_alt_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+
+    // Correlators fall back to full templates if frequency offsets aren't multiples of half an fft bin
+    is_input_bank = (gps_correlators[0]->GetTemplateMode() == GPS_TemplateMode::INPUT_BANK);
+    if (is_input_bank) {
+        half_bin_shift = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+        half_bin_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
 
-    fft_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+        // x[n]*e^(-j*pi*n/N) shifts the spectrum down by half an fft bin
+        constexpr float PI = 3.14159265f;
+        c32_vec_oscillator_auto(half_bin_shift.data(), 0.0f, -PI / (float)block_size, block_size);
+    }
+
+    const size_t total_freq_offsets = gps_correlators[0]->GetFrequencyOffsets().size();
+    batch_corr_buf = AlignedVector<std::complex<float>>(TOTAL_PRN_CODES*total_freq_offsets*block_size, SIMD_ALIGN_AMOUNT);
+    active_correlator_indices.reserve(TOTAL_PRN_CODES);
+    batch_coarse_offsets.reserve(TOTAL_PRN_CODES+1);
+    batch_search_offsets.reserve(TOTAL_PRN_CODES+1);
+    batch_multiply_tasks.resize(gps_correlator_thread_pool.GetTotalThreads());
+    for (auto& tasks: batch_multiply_tasks) {
+        tasks.reserve(2*total_freq_offsets*TOTAL_PRN_CODES);
+    }
+    spectrum = CreateSpectrum();
+}
+
+GPS_Spectrum GPS_App::CreateSpectrum() const {
+    GPS_Spectrum y;
+    y.fft_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    y.fft_alt_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    if (is_input_bank) {
+        y.input_bank_buf = AlignedVector<std::complex<float>>(4*block_size, SIMD_ALIGN_AMOUNT);
+        auto bank = tcb::span(y.input_bank_buf.data(), y.input_bank_buf.size());
+        y.input_bank.base = bank.subspan(0, 2*block_size);
+        y.input_bank.half_bin = bank.subspan(2*block_size, 2*block_size);
+    }
+    return y;
 }
 
 void GPS_App::Process(tcb::span<const std::complex<float>> x) {
+    TransformBlock(x, spectrum);
+    CorrelateBlock(x, spectrum);
+}
+
+void GPS_App::TransformBlock(tcb::span<const std::complex<float>> x, GPS_Spectrum& y) {
     assert(x.size() == (size_t)block_size);
     assert(((uintptr_t)x.data() % SIMD_ALIGN_AMOUNT) == 0u);
 
-    CalculateFFT(x, fft_buf);
+    if (fold_index == 0) {
+        fold_count = (coherent_fold_count > 1) ? coherent_fold_count : 1;
+    }
+
+    y.is_folded = (fold_count > 1);
+    y.is_ready = true;
+    if (fold_count > 1) {
+        if (!FoldBlock(x)) {
+            y.is_ready = false;
+            return;
+        }
+        fft_plan.Execute(fold_buf, y.fft_buf);
+        if (is_input_bank) {
+            UpdateInputBank(fold_alt_buf, y);
+        } else {
+            fft_plan.Execute(fold_alt_buf, y.fft_alt_buf);
+        }
+    } else {
+        fft_plan.Execute(x, y.fft_buf);
+        if (is_input_bank) {
+            UpdateInputBank(x, y);
+        }
+    }
+}
+
+void GPS_App::CorrelateBlock(tcb::span<const std::complex<float>> x, const GPS_Spectrum& y) {
+    assert(x.size() == (size_t)block_size);
+
+    // Trackers run on every block regardless of coherent folding
+    ProcessTrackers(x);
+
+    if (!y.is_ready) {
+        total_blocks_read++;
+        return;
+    }
+
+    SpectrumView view;
+    view.fft = y.fft_buf;
+    view.fft_alt = y.GetAlternatingSpectrum();
+    view.input_bank = y.input_bank;
+    CorrelateSpectrum(view);
+    total_blocks_read++;
+}
+
+void GPS_App::CorrelateSpectrum(const SpectrumView& y) {
+    active_correlator_indices.clear();
     const size_t total_correlators = gps_correlators.size();
     for (size_t i = 0; i < total_correlators; i++) {
-        auto& correlator = gps_correlators[i];
-        auto& trigger_flag = gps_correlator_trigger_flags[i];
+        if (SelectCorrelator(i)) {
+            active_correlator_indices.push_back(i);
+        }
+    }
+
+    const size_t total_active = active_correlator_indices.size();
+    if (is_batch_correlate) {
+        CorrelateBatch(y);
+    } else {
+        gps_correlator_thread_pool.ParallelFor(total_active, [this, &y](const size_t i) {
+            const size_t index = active_correlator_indices[i];
+            auto& correlator = *gps_correlators[index];
+            if (is_input_bank) {
+                correlator.Process(y.input_bank);
+            } else {
+                correlator.Process(y.fft, y.fft_alt);
+            }
+            UpdateAcquisition(index);
+        });
+    }
+}
+
+void GPS_App::ProcessBatch(tcb::span<const std::complex<float>> x, const size_t n_blocks) {
+    const size_t N = (size_t)block_size;
+    assert(x.size() == n_blocks*N);
+    if (n_blocks == 0) {
+        return;
+    }
+
+    TransformBlockBatch(x, n_blocks);
 
-        bool is_correlate = false;
-        if (trigger_flag > 0) {
-            is_correlate = true;
-            trigger_flag--;
+    // A prn that is neither tracked nor triggered stays idle for the whole batch since only its own correlator
+    // can lock its tracker and trigger flags only count down
+    auto& prn_indices = block_batch_prn_indices;
+    prn_indices.clear();
+    size_t total_triggered = 0;
+    const size_t total_correlators = gps_correlators.size();
+    for (size_t i = 0; i < total_correlators; i++) {
+        auto& tracker = gps_trackers[i];
+        if (!is_tracking) {
+            tracker.Stop();
+        }
+        const bool is_triggered = GetIsCorrelatorTriggered(i);
+        if (is_triggered || tracker.GetIsLocked()) {
+            prn_indices.push_back(i);
+        }
+        if (is_triggered) {
+            total_triggered++;
         }
-        is_correlate = is_correlate || is_always_correlate;
+    }
 
-        if (is_correlate) {
-            gps_correlator_thread_pool.PushTask([&correlator, this]() {
-                correlator.Process(fft_buf);
-            });
+    // Too few prns to occupy every thread so correlate each block with its frequency offsets split across threads
+    const size_t total_spectrums = block_batch_spectrums.size();
+    if (total_triggered > 0 && total_triggered < gps_correlator_thread_pool.GetTotalThreads()) {
+        size_t spectrum_index = 0;
+        for (size_t k = 0; k < n_blocks; k++) {
+            for (const size_t i: prn_indices) {
+                ProcessTracker(i, x.subspan(k*N, N));
+            }
+            if (spectrum_index < total_spectrums && block_batch_spectrums[spectrum_index].block_index == k) {
+                CorrelateSpectrum(block_batch_spectrums[spectrum_index].spectrum);
+                spectrum_index++;
+            }
         }
+        total_blocks_read += (int)n_blocks;
+        return;
     }
 
-    gps_correlator_thread_pool.WaitAll();
-    total_blocks_read++;
+    // prns are independent so each one runs its tracker and correlator over every block in order
+    gps_correlator_thread_pool.ParallelFor(prn_indices.size(), [this, x, n_blocks, N, total_spectrums](const size_t j) {
+        const size_t i = block_batch_prn_indices[j];
+        auto& correlator = *gps_correlators[i];
+        size_t spectrum_index = 0;
+        for (size_t k = 0; k < n_blocks; k++) {
+            ProcessTracker(i, x.subspan(k*N, N));
+            // skip blocks that are still being folded
+            if (spectrum_index >= total_spectrums) {
+                continue;
+            }
+            const auto& y = block_batch_spectrums[spectrum_index];
+            if (y.block_index != k) {
+                continue;
+            }
+            spectrum_index++;
+
+            if (!SelectCorrelator(i)) {
+                continue;
+            }
+            if (is_input_bank) {
+                correlator.Process(y.spectrum.input_bank);
+            } else {
+                correlator.Process(y.spectrum.fft, y.spectrum.fft_alt);
+            }
+            UpdateAcquisition(i);
+        }
+    });
+    total_blocks_read += (int)n_blocks;
+}
+
+void GPS_App::ReserveBlockBatch(const size_t n_blocks) {
+    block_batch_spectrums.reserve(n_blocks);
+    block_batch_prn_indices.reserve(gps_correlators.size());
+    if (n_blocks <= block_batch_capacity) {
+        return;
+    }
+    const size_t N = (size_t)block_size;
+    block_batch_capacity = n_blocks;
+    block_batch_fft_buf = AlignedVector<std::complex<float>>(n_blocks*N, SIMD_ALIGN_AMOUNT);
+    block_batch_fft_alt_buf = AlignedVector<std::complex<float>>(n_blocks*N, SIMD_ALIGN_AMOUNT);
+    if (is_input_bank) {
+        block_batch_input_bank_buf = AlignedVector<std::complex<float>>(4*n_blocks*N, SIMD_ALIGN_AMOUNT);
+    }
+}
+
+void GPS_App::TransformBlockBatch(tcb::span<const std::complex<float>> x, const size_t n_blocks) {
+    const size_t N = (size_t)block_size;
+    ReserveBlockBatch(n_blocks);
+    auto fft_buf = tcb::span(block_batch_fft_buf.data(), n_blocks*N);
+    auto fft_alt_buf = tcb::span(block_batch_fft_alt_buf.data(), n_blocks*N);
+
+    // pack the blocks that complete a fold so their ffts can be done as one batch
+    block_batch_spectrums.clear();
+    size_t total_alt = 0;
+    for (size_t k = 0; k < n_blocks; k++) {
+        auto x_block = x.subspan(k*N, N);
+        if (fold_index == 0) {
+            fold_count = (coherent_fold_count > 1) ? coherent_fold_count : 1;
+        }
+        const bool is_folded = (fold_count > 1);
+        if (is_folded && !FoldBlock(x_block)) {
+            continue;
+        }
+        const auto* x_fold = is_folded ? fold_buf.data() : x_block.data();
+        const auto* x_alt = is_folded ? fold_alt_buf.data() : x_block.data();
+
+        BlockBatchSpectrum y;
+        y.block_index = k;
+        auto y_fft = fft_buf.subspan(block_batch_spectrums.size()*N, N);
+        std::copy_n(x_fold, N, y_fft.data());
+        y.spectrum.fft = y_fft;
+        y.spectrum.fft_alt = y_fft;
+        // without folding the alternating spectrum is the same as the spectrum
+        if (is_input_bank || is_folded) {
+            auto y_alt = fft_alt_buf.subspan(total_alt*N, N);
+            if (is_input_bank) {
+                c32_vec_mul_auto(x_alt, half_bin_shift.data(), y_alt.data(), block_size);
+            } else {
+                std::copy_n(x_alt, N, y_alt.data());
+            }
+            y.spectrum.fft_alt = y_alt;
+            total_alt++;
+        }
+        block_batch_spectrums.push_back(y);
+    }
+
+    const size_t total_spectrums = block_batch_spectrums.size();
+    if (total_spectrums > 0) {
+        fft_batch_plan.ExecuteInplace(fft_buf.first(total_spectrums*N));
+    }
+    if (total_alt > 0) {
+        fft_batch_plan.ExecuteInplace(fft_alt_buf.first(total_alt*N));
+    }
+
+    if (!is_input_bank) {
+        return;
+    }
+    // the alternating spectrum is shifted by half an fft bin for the input bank
+    auto bank_buf = tcb::span(block_batch_input_bank_buf.data(), 4*n_blocks*N);
+    for (size_t i = 0; i < total_spectrums; i++) {
+        auto& y = block_batch_spectrums[i].spectrum;
+        auto bank = bank_buf.subspan(4*i*N, 4*N);
+        auto base = bank.subspan(0, 2*N);
+        auto half_bin = bank.subspan(2*N, 2*N);
+        std::copy_n(y.fft.data(), N, base.data());
+        std::copy_n(y.fft.data(), N, base.data()+N);
+        std::copy_n(y.fft_alt.data(), N, half_bin.data());
+        std::copy_n(y.fft_alt.data(), N, half_bin.data()+N);
+        y.input_bank.base = base;
+        y.input_bank.half_bin = half_bin;
+    }
+}
+
+bool GPS_App::FoldBlock(tcb::span<const std::complex<float>> x) {
+    // Normalise so a signal that is coherent across blocks keeps the same amplitude
+    const float scale = 1.0f / (float)fold_count;
+    const float alt_scale = (fold_index % 2) ? -scale : scale;
+    if (fold_index == 0) {
+        for (int i = 0; i < block_size; i++) {
+            fold_buf[i] = x[i]*scale;
+            fold_alt_buf[i] = x[i]*alt_scale;
+        }
+    } else {
+        for (int i = 0; i < block_size; i++) {
+            fold_buf[i] += x[i]*scale;
+            fold_alt_buf[i] += x[i]*alt_scale;
+        }
+    }
+
+    fold_index++;
+    if (fold_index < fold_count) {
+        return false;
+    }
+    fold_index = 0;
+    return true;
+}
+
+void GPS_App::UpdateInputBank(tcb::span<const std::complex<float>> x_alt, GPS_Spectrum& y) {
+    const size_t N = (size_t)block_size;
+    auto bank = tcb::span(y.input_bank_buf.data(), y.input_bank_buf.size());
+    auto base = bank.subspan(0, 2*N);
+    auto half_bin = bank.subspan(2*N, 2*N);
+
+    std::copy_n(y.fft_buf.data(), N, base.data());
+    std::copy_n(base.data(), N, base.data()+N);
+
+    c32_vec_mul_auto(x_alt.data(), half_bin_shift.data(), half_bin_buf.data(), block_size);
+    fft_plan.Execute(half_bin_buf, half_bin.first(N));
+    std::copy_n(half_bin.data(), N, half_bin.data()+N);
+}
+
+// Calls func(active_index, correlator_start, correlator_end, batch_start) for the part of each active correlator 
+// that lies within [start, end) of a batched search stage
+template <typename F>
+static void ForEachBatchSegment(const std::vector<size_t>& offsets, size_t start, const size_t end, F&& func) {
+    assert(!offsets.empty());
+    assert(end <= offsets.back());
+    // last correlator that starts at or before the range
+    size_t i = size_t(std::upper_bound(offsets.begin(), offsets.end(), start) - offsets.begin()) - 1;
+    while (start < end) {
+        const size_t segment_end = std::min(end, offsets[i+1]);
+        if (segment_end > start) {
+            func(i, start-offsets[i], segment_end-offsets[i], start);
+            start = segment_end;
+        }
+        i++;
+    }
+}
+
+void GPS_App::CorrelateBatch(const SpectrumView& y) {
+    auto& pool = gps_correlator_thread_pool;
+    const size_t total_active = active_correlator_indices.size();
+    const size_t total_threads = pool.GetTotalThreads();
+
+    // Each stage is split evenly into a chunk per thread so each thread performs a single batched ifft
+    // NOTE: Fewer active correlators means smaller ranges of frequency offsets per chunk
+    const auto run_chunks = [&pool, total_threads](const size_t total, auto&& run_chunk) {
+        const size_t total_chunks = std::min(total, total_threads);
+        pool.ParallelFor(total_chunks, [total, total_chunks, &run_chunk](const size_t i) {
+            const size_t start = (i*total) / total_chunks;
+            const size_t end = ((i+1)*total) / total_chunks;
+            run_chunk(i, start, end);
+        });
+    };
+
+    // coarse search
+    batch_coarse_offsets.clear();
+    batch_coarse_offsets.push_back(0);
+    for (size_t i = 0; i < total_active; i++) {
+        auto& correlator = *gps_correlators[active_correlator_indices[i]];
+        correlator.StartCoarseSearch();
+        batch_coarse_offsets.push_back(batch_coarse_offsets.back() + correlator.GetTotalCoarseCorrelations());
+    }
+    run_chunks(batch_coarse_offsets.back(), [this, &y](const size_t i, const size_t start, const size_t end) {
+        CorrelateCoarseChunk(y, i, start, end);
+    });
+
+    // full resolution search
+    pool.ParallelFor(total_active, [this](const size_t i) {
+        gps_correlators[active_correlator_indices[i]]->StartSearch();
+    });
+    batch_search_offsets.clear();
+    batch_search_offsets.push_back(0);
+    for (size_t i = 0; i < total_active; i++) {
+        auto& correlator = *gps_correlators[active_correlator_indices[i]];
+        batch_search_offsets.push_back(batch_search_offsets.back() + correlator.GetTotalSearchCorrelations());
+    }
+    run_chunks(batch_search_offsets.back(), [this, &y](const size_t i, const size_t start, const size_t end) {
+        CorrelateSearchChunk(y, i, start, end);
+    });
+
+    pool.ParallelFor(total_active, [this](const size_t i) {
+        const size_t index = active_correlator_indices[i];
+        gps_correlators[index]->EndSearch();
+        UpdateAcquisition(index);
+    });
+}
+
+void GPS_App::CorrelateCoarseChunk(const SpectrumView& spectrum, const size_t chunk_index, const size_t start, const size_t end) {
+    const size_t N = (size_t)gps_correlators[0]->GetCoarseBlockSize();
+    auto corr_buf = tcb::span(batch_corr_buf.data(), batch_corr_buf.size());
+
+    // Every correlator multiplies the same input spectrum so tiles of it are shared across the chunk
+    auto& multiply_tasks = batch_multiply_tasks[chunk_index];
+    multiply_tasks.clear();
+    ForEachBatchSegment(batch_coarse_offsets, start, end, 
+        [this, N, corr_buf, &spectrum, &multiply_tasks](const size_t i, const size_t i0, const size_t i1, const size_t offset) {
+            auto& correlator = *gps_correlators[active_correlator_indices[i]];
+            auto y = corr_buf.subspan(offset*N, (i1-i0)*N);
+            if (is_input_bank) {
+                correlator.AppendCoarseMultiplyTasks(spectrum.input_bank, y, i0, i1, multiply_tasks);
+            } else {
+                correlator.AppendCoarseMultiplyTasks(spectrum.fft, y, i0, i1, multiply_tasks);
+            }
+        });
+    const int multiply_size = gps_correlators[0]->GetCoarseMultiplySize();
+    c32_vec_mul_tiled_auto(multiply_tasks.data(), (int)multiply_tasks.size(), multiply_size);
+
+    coarse_ifft_batch_plan.ExecuteInplace(corr_buf.subspan(start*N, (end-start)*N));
+
+    ForEachBatchSegment(batch_coarse_offsets, start, end, 
+        [this, N, corr_buf](const size_t i, const size_t i0, const size_t i1, const size_t offset) {
+            auto& correlator = *gps_correlators[active_correlator_indices[i]];
+            correlator.CalculateCoarseCorrelations(corr_buf.subspan(offset*N, (i1-i0)*N), i0, i1);
+        });
+}
+
+void GPS_App::CorrelateSearchChunk(const SpectrumView& spectrum, const size_t chunk_index, const size_t start, const size_t end) {
+    const size_t N = (size_t)block_size;
+    auto corr_buf = tcb::span(batch_corr_buf.data(), batch_corr_buf.size());
+
+    auto& multiply_tasks = batch_multiply_tasks[chunk_index];
+    multiply_tasks.clear();
+    ForEachBatchSegment(batch_search_offsets, start, end, 
+        [this, N, corr_buf, &spectrum, &multiply_tasks](const size_t i, const size_t i0, const size_t i1, const size_t offset) {
+            auto& correlator = *gps_correlators[active_correlator_indices[i]];
+            auto y = corr_buf.subspan(offset*N, (i1-i0)*N);
+            if (is_input_bank) {
+                correlator.AppendMultiplyTasks(spectrum.input_bank, y, i0, i1, multiply_tasks);
+            } else {
+                correlator.AppendMultiplyTasks(spectrum.fft, spectrum.fft_alt, y, i0, i1, multiply_tasks);
+            }
+        });
+    c32_vec_mul_tiled_auto(multiply_tasks.data(), (int)multiply_tasks.size(), block_size);
+
+    ifft_batch_plan.ExecuteInplace(corr_buf.subspan(start*N, (end-start)*N));
+
+    ForEachBatchSegment(batch_search_offsets, start, end, 
+        [this, N, corr_buf](const size_t i, const size_t i0, const size_t i1, const size_t offset) {
+            auto& correlator = *gps_correlators[active_correlator_indices[i]];
+            correlator.CalculateCorrelations(corr_buf.subspan(offset*N, (i1-i0)*N), i0, i1);
+        });
+}
+
+void GPS_App::ProcessTrackers(tcb::span<const std::complex<float>> x) {
+    const size_t total_trackers = gps_trackers.size();
+    for (size_t i = 0; i < total_trackers; i++) {
+        ProcessTracker(i, x);
+    }
+}
+
+void GPS_App::ProcessTracker(const size_t index, tcb::span<const std::complex<float>> x) {
+    auto& tracker = gps_trackers[index];
+    if (!is_tracking) {
+        tracker.Stop();
+        return;
+    }
+    if (!tracker.GetIsLocked()) {
+        return;
+    }
+    tracker.Process(x);
+    // Search from scratch once lock is lost
+    if (!tracker.GetIsLocked()) {
+        gps_correlators[index]->ResetFrequencyOffsetHistogram();
+    }
+}
+
+// Correlators search a block if they have been triggered and their prn isn't being tracked
+bool GPS_App::SelectCorrelator(const size_t index) {
+    auto& correlator = *gps_correlators[index];
+    auto& trigger_flag = gps_correlator_trigger_flags[index];
+
+    bool is_correlate = GetIsCorrelatorTriggered(index);
+    if (trigger_flag > 0) {
+        trigger_flag--;
+    }
+    is_correlate = is_correlate && !gps_trackers[index].GetIsLocked();
+
+    if (!is_correlate) {
+        return false;
+    }
+
+    correlator.SetNonCoherentCount(noncoherent_count);
+    correlator.SetIsTwoStageSearch(is_two_stage_search);
+    return true;
+}
+
+bool GPS_App::GetIsCorrelatorTriggered(const size_t index) const {
+    return (gps_correlator_trigger_flags[index] > 0) || is_always_correlate;
+}
+
+void GPS_App::UpdateAcquisition(const size_t correlator_index) {
+    if (!is_tracking) {
+        return;
+    }
+
+    auto& correlator = *gps_correlators[correlator_index];
+    const auto& histogram = correlator.GetFrequencyOffsetHistogram();
+    const int total_counts = histogram.GetTotalCounts();
+    if (total_counts < ACQUISITION_MIN_COUNTS) {
+        return;
+    }
+
+    const int best_index = correlator.GetBestFrequencyOffsetIndex();
+    const int mode_index = histogram.GetMode();
+    if (best_index != mode_index) {
+        return;
+    }
+
+    const int mode_count = histogram.GetCount(mode_index);
+    if ((float)mode_count < ACQUISITION_MIN_MODE_FRACTION*(float)total_counts) {
+        return;
+    }
+
+    const auto& peak = correlator.GetCorrelationPeaks()[best_index];
+    if (peak.value < ACQUISITION_MIN_PEAK_RATIO*peak.second_value) {
+        return;
+    }
+
+    const float code_phase = (float)correlator.GetCodePhase(peak.index);
+    const float carrier_frequency = correlator.GetFrequencyOffsets()[best_index];
+    gps_trackers[correlator_index].Start(code_phase, carrier_frequency);
 }
\ No newline at end of file
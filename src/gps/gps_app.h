@@ -1,29 +1,144 @@
 #pragma once
 
 #include <complex>
+#include <memory>
+#include <vector>
 #include "gps_correlator.h"
-#include "utility/basic_thread_pool.h"
+#include "gps_tracker.h"
+#include "dsp/calculate_fft.h"
+#include "utility/work_stealing_pool.h"
 #include "utility/aligned_vector.h"
 #include "utility/span.h"
 
+// Spectrum of a block that is handed from the fft stage to the correlation stage
+// NOTE: is_ready is false while blocks are still being coherently folded
+struct GPS_Spectrum {
+    bool is_ready = false;
+    bool is_folded = false;
+    AlignedVector<std::complex<float>> fft_buf;
+    AlignedVector<std::complex<float>> fft_alt_buf;
+    // frequency shifted input spectrums shared by every correlator
+    AlignedVector<std::complex<float>> input_bank_buf;
+    GPS_InputBank input_bank;
+    // Without folding the alternating spectrum is the same as the spectrum
+    tcb::span<const std::complex<float>> GetAlternatingSpectrum() const {
+        return is_folded ? fft_alt_buf : fft_buf;
+    }
+};
+
 class GPS_App 
 {
 private:
     const int block_size;
-    AlignedVector<std::complex<float>> fft_buf;
-    std::vector<GPS_Correlator> gps_correlators;
-    BasicThreadPool gps_correlator_thread_pool;
+    // plans are resolved once here so worker threads don't contend on the fft planner
+    FFT_Plan fft_plan;
+    FFT_BatchPlan fft_batch_plan;
+    FFT_BatchPlan ifft_batch_plan;
+    FFT_BatchPlan coarse_ifft_batch_plan;
+    // coherent folding of consecutive blocks before the fft
+    // fold_alt_buf alternates the sign of each block for frequency offsets that rotate by half a cycle per block
+    // NOTE: A change in the number of blocks is applied at the start of the next fold
+    int coherent_fold_count = 1;
+    int fold_count = 1;
+    int fold_index = 0;
+    AlignedVector<std::complex<float>> fold_buf;
+    AlignedVector<std::complex<float>> fold_alt_buf;
+    // NOTE: The half fft bin shift of the input bank uses the alternating fold since it rotates by half a cycle per block
+    bool is_input_bank = false;
+    AlignedVector<std::complex<float>> half_bin_shift;
+    AlignedVector<std::complex<float>> half_bin_buf;
+    // spectrum used by Process
+    GPS_Spectrum spectrum;
+    std::vector<std::unique_ptr<GPS_Correlator>> gps_correlators;
+    WorkStealingPool gps_correlator_thread_pool;
+    // batched correlation of all frequency offsets of active correlators
+    // Correlations of a search stage are packed one after the other for every active correlator
+    // batch_*_offsets[i] is where the correlations of active correlator i start with the total at the end
+    // NOTE: Each stage is split into one contiguous chunk per thread regardless of which correlator a correlation
+    //       belongs to. This spreads the frequency offsets of a single active correlator across every thread
+    AlignedVector<std::complex<float>> batch_corr_buf;
+    std::vector<size_t> active_correlator_indices;
+    std::vector<size_t> batch_coarse_offsets;
+    std::vector<size_t> batch_search_offsets;
+    // multiplies of every correlator in a chunk are tiled together since they share the input spectrum
+    std::vector<std::vector<c32_vec_mul_task_t>> batch_multiply_tasks;
+    // spectrum of a block that is shared by every correlator
+    struct SpectrumView {
+        tcb::span<const std::complex<float>> fft;
+        tcb::span<const std::complex<float>> fft_alt;
+        GPS_InputBank input_bank;
+    };
+    // blocks passed to ProcessBatch that complete a fold have their ffts done together
+    // NOTE: Buffers grow to fit the largest batch of blocks
+    struct BlockBatchSpectrum {
+        size_t block_index;
+        SpectrumView spectrum;
+    };
+    size_t block_batch_capacity = 0;
+    AlignedVector<std::complex<float>> block_batch_fft_buf;
+    AlignedVector<std::complex<float>> block_batch_fft_alt_buf;
+    AlignedVector<std::complex<float>> block_batch_input_bank_buf;
+    std::vector<BlockBatchSpectrum> block_batch_spectrums;
+    // prns with a locked tracker or that can still be selected for correlation during the batch
+    std::vector<size_t> block_batch_prn_indices;
 
     int total_blocks_read = 0;
     bool is_always_correlate = false;
+    bool is_batch_correlate = true;
+    // Prns without a coarse detection skip the full resolution search which makes searching them 3-5x cheaper
+    // NOTE: A prn only gets a full resolution search once the coarse stage has detected it over a few blocks
+    bool is_two_stage_search = true;
+    int noncoherent_count = 1;
     std::vector<int> gps_correlator_trigger_flags;
+    // Acquired prns are handed over to a time domain tracker and skip the fft search
+    // NOTE: A prn goes back to acquisition when its tracker loses lock
+    bool is_tracking = false;
+    std::vector<GPS_Tracker> gps_trackers;
 public:
-    GPS_App(const int _Fs, const int _Fcode, const int _Fdev_max);
+    GPS_App(
+        const int _Fs, const int _Fcode, const int _Fdev_max, 
+        const GPS_TemplateMode _template_mode=GPS_TemplateMode::INPUT_BANK,
+        const size_t _total_threads=0);
     void Process(tcb::span<const std::complex<float>> x);
+    // Process is split into an fft stage and a correlation stage which can run on different threads
+    // so that the next block is transformed while the current one is being correlated
+    // NOTE: Each stage has to be called from one thread at a time with blocks in order
+    //       Blocks in flight between the two stages need their own spectrum from CreateSpectrum
+    GPS_Spectrum CreateSpectrum() const;
+    void TransformBlock(tcb::span<const std::complex<float>> x, GPS_Spectrum& y);
+    void CorrelateBlock(tcb::span<const std::complex<float>> x, const GPS_Spectrum& y);
+    // Same as calling Process on n_blocks consecutive blocks
+    // The forward ffts of every block are batched and each busy prn goes through all the blocks in order
+    // in a single fork-join so the dispatch cost is paid once per batch instead of once per block
+    // NOTE: With fewer prns to correlate than threads each block is correlated like Process instead
+    //       so that the frequency offsets of those prns are spread across every thread
+    void ProcessBatch(tcb::span<const std::complex<float>> x, const size_t n_blocks);
+private:
+    bool FoldBlock(tcb::span<const std::complex<float>> x);
+    void ReserveBlockBatch(const size_t n_blocks);
+    void TransformBlockBatch(tcb::span<const std::complex<float>> x, const size_t n_blocks);
+    void UpdateInputBank(tcb::span<const std::complex<float>> x_alt, GPS_Spectrum& y);
+    void CorrelateSpectrum(const SpectrumView& y);
+    void CorrelateBatch(const SpectrumView& y);
+    void CorrelateCoarseChunk(const SpectrumView& y, const size_t chunk_index, const size_t start, const size_t end);
+    void CorrelateSearchChunk(const SpectrumView& y, const size_t chunk_index, const size_t start, const size_t end);
+    void ProcessTrackers(tcb::span<const std::complex<float>> x);
+    void ProcessTracker(const size_t index, tcb::span<const std::complex<float>> x);
+    bool SelectCorrelator(const size_t index);
+    bool GetIsCorrelatorTriggered(const size_t index) const;
+    void UpdateAcquisition(const size_t correlator_index);
 public:
     int GetBlockSize() const { return block_size; }
     int GetTotalBlocksRead() const { return total_blocks_read; }
     auto& GetCorrelators() { return gps_correlators; }
     auto& GetCorrelatorTriggerFlags() { return gps_correlator_trigger_flags; }
+    auto& GetTrackers() { return gps_trackers; }
+    auto& GetCorrelatorThreadPool() { return gps_correlator_thread_pool; }
+    bool GetIsInputBank() const { return is_input_bank; }
+    auto& GetIsTracking() { return is_tracking; }
     auto& GetIsAlwaysCorrelate() { return is_always_correlate; }
+    auto& GetIsBatchCorrelate() { return is_batch_correlate; }
+    auto& GetIsTwoStageSearch() { return is_two_stage_search; }
+    auto& GetNonCoherentCount() { return noncoherent_count; }
+    auto& GetCoherentFoldCount() { return coherent_fold_count; }
 };
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "gps_correlator.h"
 #include <assert.h>
 #include <cmath>
+#include <algorithm>
 #include "dsp/simd/c32_vec_mul.h"
+#include "dsp/simd/c32_vec_mag_accumulate.h"
+#include "dsp/simd/c32_vec_oscillator.h"
 #include "dsp/calculate_fft.h"
 #include "dsp/fftshift.h"
 
@@ -11,29 +14,38 @@ static void ApplyFrequencyShift(
     const float k) 
 {
     assert(x.size() == y.size());
-    const size_t N = x.size();
+    const int N = (int)x.size();
     constexpr float PI = 3.14159265f;
     const float step = 2.0f * PI * k;
-    float dt = 0.0f;
-    for (size_t i = 0; i < N; i++) {
-        const auto pll = std::complex<float>(std::cos(dt), std::sin(dt));
-        dt = std::fmod(dt + step, 2.0f * PI);
-        y[i] = x[i] * pll;
-    }
+    c32_vec_mix_oscillator_auto(x.data(), y.data(), 0.0f, step, N);
 };
 
 // NOTE: AVX2 is 256bit = 32bytes
 constexpr size_t SIMD_ALIGN_AMOUNT = 32u;
 
+// Templates of a group are multiplied one tile at a time so the output of a group should fit in L2 cache
+constexpr size_t MULTIPLY_GROUP_BYTES = 128u*1024u;
+
+// Coarse correlations are integrated over this many blocks before deciding which frequency offsets are searched
+constexpr int COARSE_DWELL_BLOCKS = 8;
+// Cell averaging CFAR where a coarse peak is detected if it is this many times the mean integrated power
+// of every coarse correlation. The mean is the noise floor since a signal only occupies a few cells
+constexpr float COARSE_DETECTION_THRESHOLD = 2.1f;
+// At most this many of the strongest coarse detections get a full resolution search
+constexpr int COARSE_TOTAL_CANDIDATES = 2;
+
 GPS_Correlator::GPS_Correlator(
     tcb::span<uint8_t> _logical_prn_code, 
     const int _block_size, 
-    const int _Fcode, const int _Fs, const int _Fdev_max)
+    const int _Fcode, const int _Fs, const int _Fdev_max,
+    const GPS_TemplateMode _template_mode)
 :   block_size(_block_size), 
     Fcode(_Fcode), Fs(_Fs), Fdev_max(_Fdev_max),
-    Ts(1.0f/(float)_Fs)
+    Ts(1.0f/(float)_Fs),
+    template_mode(_template_mode)
 {
     // Possible frequency shifts we should search for when correlating
+    // NOTE: Keep in sync with GetTotalFrequencyOffsets()
     const int Fshift_step = Fcode/2;
     for (int i = -Fdev_max; i <= +Fdev_max; i+=Fshift_step) {
         freq_offsets.push_back((float)i);
@@ -41,16 +53,75 @@ GPS_Correlator::GPS_Correlator(
     const int TOTAL_FREQ_OFFSETS = (int)freq_offsets.size();
 
     freq_offset_index_histogram = std::make_unique<Histogram>(TOTAL_FREQ_OFFSETS);
+    freq_shifted_correlation_peaks.resize(TOTAL_FREQ_OFFSETS);
+
+    const int total_chips = (int)_logical_prn_code.size();
+    peak_exclusion = (block_size + total_chips - 1) / total_chips;
+
+    // Rotation only works if every frequency offset is a multiple of half an fft bin
+    // This is the case when the sample rate is a multiple of the code rate
+    if ((template_mode == GPS_TemplateMode::ROTATE) || (template_mode == GPS_TemplateMode::INPUT_BANK)) {
+        for (int i = -Fdev_max; i <= +Fdev_max; i+=Fshift_step) {
+            const int64_t total_half_bins = (int64_t)i * (int64_t)block_size * 2;
+            if ((total_half_bins % (int64_t)Fs) != 0) {
+                template_mode = GPS_TemplateMode::FULL;
+                break;
+            }
+        }
+    }
+
+    // Frequency offsets that rotate by close to half a cycle per block 
+    auto get_is_alternating_input = [this](const float freq_offset) {
+        const float total_cycles = freq_offset * (float)block_size / (float)Fs;
+        const float fraction = std::abs(total_cycles - std::round(total_cycles));
+        return fraction > 0.25f;
+    };
+
+    // Determine which base spectrum and rotation each frequency offset uses
+    int TOTAL_BASES = 0;
+    std::vector<float> base_freq_offsets;
+    if (template_mode == GPS_TemplateMode::FULL) {
+        TOTAL_BASES = TOTAL_FREQ_OFFSETS;
+        for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+            const float freq_offset = freq_offsets[i];
+            freq_offset_templates.push_back({ i, 0, get_is_alternating_input(freq_offset) });
+            base_freq_offsets.push_back(freq_offset);
+        }
+    } else {
+        // f = (m + h/2)*Fbin where h = 0 or 1 selects the base spectrum and m is the rotation 
+        // With an input bank only the unshifted spectrum is needed since the input is shifted instead
+        const bool is_input_bank = (template_mode == GPS_TemplateMode::INPUT_BANK);
+        TOTAL_BASES = is_input_bank ? 1 : 2;
+        const float Fbin = (float)Fs / (float)block_size;
+        for (int i = -Fdev_max; i <= +Fdev_max; i+=Fshift_step) {
+            const int total_half_bins = (int)(((int64_t)i * (int64_t)block_size * 2) / (int64_t)Fs);
+            const int half_bin = ((total_half_bins % 2) + 2) % 2;
+            const int rotation = (total_half_bins - half_bin) / 2;
+            freq_offset_templates.push_back({ half_bin, rotation, half_bin == 1 });
+        }
+        base_freq_offsets.push_back(0.0f);
+        if (!is_input_bank) {
+            base_freq_offsets.push_back(0.5f*Fbin);
+        }
+    }
 
     // Allocate buffers
-    for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
-        freq_shifted_prn_codes.push_back({ (size_t)block_size, SIMD_ALIGN_AMOUNT });
+    for (int i = 0; i < TOTAL_BASES; i++) {
         freq_shifted_prn_ffts.push_back({ (size_t)block_size, SIMD_ALIGN_AMOUNT });
+    }
+    // NOTE: Correlations are cleared since the coarse stage only writes them at the end of its first dwell
+    for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
         freq_shifted_correlation_output.push_back({ (size_t)block_size, SIMD_ALIGN_AMOUNT });
+        auto& freq_shifted_corr_out = freq_shifted_correlation_output.back();
+        std::fill(freq_shifted_corr_out.begin(), freq_shifted_corr_out.end(), 0.0f);
     }
-    // correlation fft buffer
-    corr_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    // correlation fft buffer for a group of templates
+    const size_t block_bytes = (size_t)block_size*sizeof(std::complex<float>);
+    multiply_group_size = (int)std::clamp(MULTIPLY_GROUP_BYTES/block_bytes, size_t(1), (size_t)TOTAL_FREQ_OFFSETS);
+    multiply_tasks.reserve(2*(size_t)multiply_group_size);
+    corr_buf = AlignedVector<std::complex<float>>((size_t)multiply_group_size*(size_t)block_size, SIMD_ALIGN_AMOUNT);
     ifft_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    ifft_plan = FFT_Plan((size_t)block_size, true);
 
     // nearest neighbour upsampling of code to sampling frequency
     auto prn_code = std::vector<std::complex<float>>(block_size);
@@ -69,47 +140,500 @@ GPS_Correlator::GPS_Correlator(
     }
 
     // Generate frequency shifted prn codes and their associated FFT
-    for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
-        const float freq_offset = freq_offsets[i];
-        auto& freq_shifted_prn_code = freq_shifted_prn_codes[i];
-        auto& freq_shifted_prn_fft = freq_shifted_prn_ffts[i];
+    auto freq_shifted_prn_code = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    for (int i = 0; i < TOTAL_BASES; i++) {
+        const float freq_offset = base_freq_offsets[i];
+        auto freq_shifted_prn_fft = tcb::span(freq_shifted_prn_ffts[i].data(), (size_t)block_size);
 
         const float k = freq_offset / (float)Fs;
         ApplyFrequencyShift(prn_code, freq_shifted_prn_code, k);
         CalculateFFT(freq_shifted_prn_code, freq_shifted_prn_fft);
     }
+
+    // For even N a circular shift of N/2 in time is a multiplication by (-1)^k in frequency
+    // This lets us skip the fftshift on the ifft output of every frequency offset
+    // NOTE: A rotated template is off by a factor of (-1)^m which doesn't change the magnitude
+    is_fftshift_folded = (block_size % 2) == 0;
+    if (is_fftshift_folded) {
+        for (auto& freq_shifted_prn_fft: freq_shifted_prn_ffts) {
+            for (int i = 1; i < block_size; i+=2) {
+                freq_shifted_prn_fft[i] = -freq_shifted_prn_fft[i];
+            }
+        }
+    }
+
+    // Coarse search decimates the spectrum by 2 so the folded fftshift holds if N/2 is even
+    // Whole fft bin offsets are a rotation of the first base spectrum
+    coarse_block_size = block_size/2;
+    is_coarse_search_supported = 
+        (template_mode != GPS_TemplateMode::FULL) && 
+        is_fftshift_folded && 
+        ((block_size % 4) == 0);
+    for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+        if (freq_offset_templates[i].base_index == 0) {
+            coarse_freq_offset_indices.push_back((size_t)i);
+        }
+        search_freq_offset_indices.push_back((size_t)i);
+    }
+    coarse_dwell_peaks.resize(coarse_freq_offset_indices.size());
+    if (is_coarse_search_supported) {
+        coarse_ifft_plan = FFT_Plan((size_t)coarse_block_size, true);
+    }
+    is_freq_offset_searched.resize(TOTAL_FREQ_OFFSETS, true);
+
+    // y[k] = x[k] * base[k-m] starts at base[-m] and wraps around to base[0]
+    // y[k] = x_h[k+m] * prn[k] starts at x_double[m]
+    const int N = block_size;
+    for (auto& freq_template: freq_offset_templates) {
+        const int m = freq_template.rotation;
+        if (template_mode == GPS_TemplateMode::INPUT_BANK) {
+            freq_template.base_start = ((m % N) + N) % N;
+        } else {
+            freq_template.base_start = (((-m) % N) + N) % N;
+        }
+        freq_template.coarse_base_start = (((3*N/4 - m) % N) + N) % N;
+    }
+}
+
+int GPS_Correlator::GetTotalFrequencyOffsets(const int Fcode, const int Fdev_max) {
+    const int Fshift_step = Fcode/2;
+    return 2*(Fdev_max / Fshift_step) + 1;
 }
 
 void GPS_Correlator::Process(tcb::span<const std::complex<float>> x_in_fft) {
+    Process(x_in_fft, x_in_fft);
+}
+
+// Generic per block path
+void GPS_Correlator::Process(tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt) {
+    ProcessImpl<0,0>(x_in_fft, x_in_fft_alt);
+}
+
+void GPS_Correlator::Process(const GPS_InputBank& input_bank) {
+    ProcessImpl<0,0>(input_bank);
+}
+
+void GPS_Correlator::CalculateCoarseCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) {
+    CalculateCoarseCorrelationsImpl<0>(x_in_ifft, start, end);
+}
+
+void GPS_Correlator::CalculateCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) {
+    CalculateCorrelationsImpl<0>(x_in_ifft, start, end);
+}
+
+void GPS_Correlator::EndSearch() {
+    EndSearchImpl<0,0>();
+}
+
+template <int N_FIXED, int D_FIXED>
+void GPS_Correlator::ProcessImpl(tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt) {
+    assert(template_mode != GPS_TemplateMode::INPUT_BANK);
     assert(x_in_fft.size() == (size_t)block_size);
+    assert(x_in_fft_alt.size() == (size_t)block_size);
 
-    const size_t TOTAL_FREQ_OFFSETS = freq_offsets.size();
+    const auto* x0 = x_in_fft.data();
+    const auto* x1 = x_in_fft_alt.data();
+    ProcessSearch<N_FIXED, D_FIXED>(
+        [this, x0](const FrequencyTemplate& freq_template, std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) {
+            AppendCoarseMultiplyTask(x0, freq_template, y, tasks);
+        },
+        [this, x0, x1](const FrequencyTemplate& freq_template, std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) {
+            const auto* x = freq_template.is_alternating_input ? x1 : x0;
+            AppendMultiplyTask(x, freq_template, y, tasks);
+        });
+}
 
-    // Get correlation for each frequency offset
-    const float K_norm_fft = 1.0f / (float)(2*block_size + 1);
-    for (size_t i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
-        auto& freq_shifted_prn_fft = freq_shifted_prn_ffts[i];
-        auto& freq_shifted_corr_out = freq_shifted_correlation_output[i];
+template <int N_FIXED, int D_FIXED>
+void GPS_Correlator::ProcessImpl(const GPS_InputBank& input_bank) {
+    assert(template_mode == GPS_TemplateMode::INPUT_BANK);
+    assert(input_bank.base.size() == 2*(size_t)block_size);
+    assert(input_bank.half_bin.size() == 2*(size_t)block_size);
+
+    ProcessSearch<N_FIXED, D_FIXED>(
+        [this, &input_bank](const FrequencyTemplate& freq_template, std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) {
+            AppendCoarseMultiplyTask(input_bank, freq_template, y, tasks);
+        },
+        [this, &input_bank](const FrequencyTemplate& freq_template, std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) {
+            AppendMultiplyTask(input_bank, freq_template, y, tasks);
+        });
+}
+
+template <int N_FIXED, int D_FIXED, typename F0, typename F1>
+void GPS_Correlator::ProcessSearch(F0&& append_coarse_task, F1&& append_task) {
+    const int N = (N_FIXED > 0) ? N_FIXED : block_size;
+    const int N_coarse = N/2;
+    const size_t GROUP_SIZE = (size_t)multiply_group_size;
+
+    StartCoarseSearch();
+    if (is_coarse_search) {
+        auto coarse_ifft_buf = tcb::span(ifft_buf.data(), (size_t)N_coarse);
+        const size_t TOTAL_COARSE = coarse_freq_offset_indices.size();
+        for (size_t i0 = 0; i0 < TOTAL_COARSE; i0 += GROUP_SIZE) {
+            const size_t i1 = std::min(i0+GROUP_SIZE, TOTAL_COARSE);
+            multiply_tasks.clear();
+            for (size_t i = i0; i < i1; i++) {
+                auto& freq_template = freq_offset_templates[coarse_freq_offset_indices[i]];
+                append_coarse_task(freq_template, &corr_buf[(i-i0)*N_coarse], multiply_tasks);
+            }
+            c32_vec_mul_tiled_auto<N_FIXED/4>(multiply_tasks.data(), (int)multiply_tasks.size(), GetCoarseMultiplySize());
+            for (size_t i = i0; i < i1; i++) {
+                auto coarse_buf = tcb::span(&corr_buf[(i-i0)*N_coarse], (size_t)N_coarse);
+                coarse_ifft_plan.Execute(coarse_buf, coarse_ifft_buf);
+                CalculateCoarseCorrelation<N_FIXED>(i, coarse_ifft_buf.data());
+            }
+        }
+    }
 
+    StartSearch();
+    // Get correlation for each searched frequency offset
+    const size_t TOTAL_SEARCH = search_freq_offset_indices.size();
+    for (size_t i0 = 0; i0 < TOTAL_SEARCH; i0 += GROUP_SIZE) {
+        const size_t i1 = std::min(i0+GROUP_SIZE, TOTAL_SEARCH);
         // multiplication in frequency domain
-        c32_vec_mul_auto(x_in_fft.data(), freq_shifted_prn_fft.data(), corr_buf.data(), block_size);
+        multiply_tasks.clear();
+        for (size_t i = i0; i < i1; i++) {
+            auto& freq_template = freq_offset_templates[search_freq_offset_indices[i]];
+            append_task(freq_template, &corr_buf[(i-i0)*N], multiply_tasks);
+        }
+        c32_vec_mul_tiled_auto<N_FIXED>(multiply_tasks.data(), (int)multiply_tasks.size(), N);
         // ifft to get impulse response in time domain
-        CalculateIFFT(corr_buf, ifft_buf);
-        InplaceFFTShift<std::complex<float>>(ifft_buf);
-        for (int j = 0; j < block_size; j++) {
-            freq_shifted_corr_out[j] = std::abs(ifft_buf[j]) * K_norm_fft;
+        for (size_t i = i0; i < i1; i++) {
+            auto group_buf = tcb::span(&corr_buf[(i-i0)*N], (size_t)N);
+            ifft_plan.Execute(group_buf, ifft_buf);
+            CalculateCorrelation<N_FIXED>(search_freq_offset_indices[i], ifft_buf.data());
+        }
+    }
+
+    EndBlock<N_FIXED, D_FIXED>();
+}
+
+void GPS_Correlator::AppendCoarseMultiplyTasks(
+    tcb::span<const std::complex<float>> x_in_fft, tcb::span<std::complex<float>> y_out, 
+    const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    const size_t N_coarse = (size_t)coarse_block_size;
+    assert(x_in_fft.size() == (size_t)block_size);
+    assert(start <= end);
+    assert(end <= GetTotalCoarseCorrelations());
+    assert(y_out.size() >= (end-start)*N_coarse);
+
+    const auto* x = x_in_fft.data();
+    auto* y = y_out.data();
+    for (size_t i = start; i < end; i++) {
+        auto& freq_template = freq_offset_templates[coarse_freq_offset_indices[i]];
+        AppendCoarseMultiplyTask(x, freq_template, &y[(i-start)*N_coarse], tasks);
+    }
+}
+
+void GPS_Correlator::AppendCoarseMultiplyTasks(
+    const GPS_InputBank& input_bank, tcb::span<std::complex<float>> y_out, 
+    const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    const size_t N_coarse = (size_t)coarse_block_size;
+    assert(template_mode == GPS_TemplateMode::INPUT_BANK);
+    assert(start <= end);
+    assert(end <= GetTotalCoarseCorrelations());
+    assert(y_out.size() >= (end-start)*N_coarse);
+
+    auto* y = y_out.data();
+    for (size_t i = start; i < end; i++) {
+        auto& freq_template = freq_offset_templates[coarse_freq_offset_indices[i]];
+        AppendCoarseMultiplyTask(input_bank, freq_template, &y[(i-start)*N_coarse], tasks);
+    }
+}
+
+template <int N_FIXED>
+void GPS_Correlator::CalculateCoarseCorrelationsImpl(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) {
+    const int N_coarse = ((N_FIXED > 0) ? N_FIXED : block_size)/2;
+    assert(start <= end);
+    assert(end <= GetTotalCoarseCorrelations());
+    assert(x_in_ifft.size() == (end-start)*(size_t)N_coarse);
+
+    auto* x = x_in_ifft.data();
+    for (size_t i = start; i < end; i++) {
+        CalculateCoarseCorrelation<N_FIXED>(i, &x[(i-start)*N_coarse]);
+    }
+}
+
+void GPS_Correlator::StartSearch() {
+    if (is_coarse_search) {
+        SelectSearchFrequencyOffsets();
+    }
+    StartBlock();
+}
+
+void GPS_Correlator::AppendMultiplyTasks(
+    tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt, 
+    tcb::span<std::complex<float>> y_out, 
+    const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    const size_t N = (size_t)block_size;
+    assert(x_in_fft.size() == N);
+    assert(x_in_fft_alt.size() == N);
+    assert(start <= end);
+    assert(end <= GetTotalSearchCorrelations());
+    assert(y_out.size() == (end-start)*N);
+
+    const auto* x0 = x_in_fft.data();
+    const auto* x1 = x_in_fft_alt.data();
+    auto* y = y_out.data();
+    for (size_t i = start; i < end; i++) {
+        auto& freq_template = freq_offset_templates[search_freq_offset_indices[i]];
+        const auto* x = freq_template.is_alternating_input ? x1 : x0;
+        AppendMultiplyTask(x, freq_template, &y[(i-start)*N], tasks);
+    }
+}
+
+void GPS_Correlator::AppendMultiplyTasks(
+    const GPS_InputBank& input_bank, tcb::span<std::complex<float>> y_out, 
+    const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    const size_t N = (size_t)block_size;
+    assert(template_mode == GPS_TemplateMode::INPUT_BANK);
+    assert(start <= end);
+    assert(end <= GetTotalSearchCorrelations());
+    assert(y_out.size() == (end-start)*N);
+
+    auto* y = y_out.data();
+    for (size_t i = start; i < end; i++) {
+        auto& freq_template = freq_offset_templates[search_freq_offset_indices[i]];
+        AppendMultiplyTask(input_bank, freq_template, &y[(i-start)*N], tasks);
+    }
+}
+
+template <int N_FIXED>
+void GPS_Correlator::CalculateCorrelationsImpl(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) {
+    const int N = (N_FIXED > 0) ? N_FIXED : block_size;
+    assert(start <= end);
+    assert(end <= GetTotalSearchCorrelations());
+    assert(x_in_ifft.size() == (end-start)*(size_t)N);
+
+    auto* x = x_in_ifft.data();
+    for (size_t i = start; i < end; i++) {
+        CalculateCorrelation<N_FIXED>(search_freq_offset_indices[i], &x[(i-start)*N]);
+    }
+}
+
+template <int N_FIXED, int D_FIXED>
+void GPS_Correlator::EndSearchImpl() {
+    EndBlock<N_FIXED, D_FIXED>();
+}
+
+void GPS_Correlator::StartCoarseSearch() {
+    // A single block integration window starts on every block
+    is_coarse_search = 
+        is_coarse_search_supported && 
+        is_two_stage_search_request &&
+        (noncoherent_index == 0) && 
+        (noncoherent_count_request <= 1);
+
+    if (is_coarse_search) {
+        if (coarse_noncoherent_power.empty()) {
+            for (size_t i = 0; i < coarse_freq_offset_indices.size(); i++) {
+                coarse_noncoherent_power.push_back({ (size_t)coarse_block_size, SIMD_ALIGN_AMOUNT });
+            }
+        }
+        if (coarse_dwell_index == 0) {
+            for (auto& power: coarse_noncoherent_power) {
+                std::fill(power.begin(), power.end(), 0.0f);
+            }
+        }
+        return;
+    }
+
+    // A dwell that was interrupted starts over when the coarse stage is used again
+    coarse_dwell_index = 0;
+    coarse_detection_indices.clear();
+    const size_t TOTAL_FREQ_OFFSETS = freq_offsets.size();
+    if (search_freq_offset_indices.size() == TOTAL_FREQ_OFFSETS) {
+        return;
+    }
+
+    search_freq_offset_indices.clear();
+    for (size_t i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+        search_freq_offset_indices.push_back(i);
+    }
+    std::fill(is_freq_offset_searched.begin(), is_freq_offset_searched.end(), true);
+}
+
+template <int N_FIXED>
+void GPS_Correlator::CalculateCoarseCorrelation(const size_t coarse_index, std::complex<float>* x_in_ifft) {
+    const int N = (N_FIXED > 0) ? N_FIXED : block_size;
+    const int N_coarse = N/2;
+    // Coarse correlation is the low pass filtered correlation at every second sample so it has the same scale
+    // Peak search is deferred until the end of the dwell
+    const float K_norm_fft = 1.0f / (float)(2*N + 1);
+    auto* power = coarse_noncoherent_power[coarse_index].data();
+    c32_vec_mag_accumulate_auto<N_FIXED/2>(x_in_ifft, power, N_coarse, K_norm_fft*K_norm_fft);
+}
+
+void GPS_Correlator::EndCoarseDwell() {
+    const size_t TOTAL_COARSE = coarse_freq_offset_indices.size();
+    const int N_coarse = coarse_block_size;
+    const int coarse_exclusion = (peak_exclusion+1)/2;
+    // Average magnitude has the same scale as the correlation of a single block
+    const float K_norm = 1.0f / (float)COARSE_DWELL_BLOCKS;
+    float noise_floor = 0.0f;
+    for (size_t i = 0; i < TOTAL_COARSE; i++) {
+        const size_t freq_offset_index = coarse_freq_offset_indices[i];
+        const auto* power = coarse_noncoherent_power[i].data();
+        auto* freq_shifted_corr_out = freq_shifted_correlation_output[freq_offset_index].data();
+        for (int j = 0; j < N_coarse; j++) {
+            freq_shifted_corr_out[j] = std::sqrt(power[j]*K_norm);
+        }
+        auto peak = f32_vec_peak_auto(freq_shifted_corr_out, N_coarse, coarse_exclusion);
+        coarse_dwell_peaks[i] = peak;
+        noise_floor += peak.mean;
+
+        // Upsample inplace from the end so offsets without a full resolution search can still be displayed
+        for (int j = N_coarse-1; j >= 0; j--) {
+            const float v = freq_shifted_corr_out[j];
+            freq_shifted_corr_out[2*j] = v;
+            freq_shifted_corr_out[2*j+1] = v;
         }
+        peak.index *= 2;
+        peak.second_index *= 2;
+        freq_shifted_correlation_peaks[freq_offset_index] = peak;
     }
+    noise_floor /= (float)TOTAL_COARSE;
+
+    // Strongest coarse peaks that pass the threshold
+    coarse_detection_indices.clear();
+    const float threshold = COARSE_DETECTION_THRESHOLD*noise_floor;
+    for (int candidate = 0; candidate < COARSE_TOTAL_CANDIDATES; candidate++) {
+        int best_coarse_index = -1;
+        float best_value = threshold;
+        for (size_t i = 0; i < TOTAL_COARSE; i++) {
+            const bool is_detected = std::find(
+                coarse_detection_indices.begin(), coarse_detection_indices.end(), i) != coarse_detection_indices.end();
+            if (!is_detected && (coarse_dwell_peaks[i].value > best_value)) {
+                best_value = coarse_dwell_peaks[i].value;
+                best_coarse_index = (int)i;
+            }
+        }
+        if (best_coarse_index < 0) {
+            break;
+        }
+        coarse_detection_indices.push_back((size_t)best_coarse_index);
+    }
+}
+
+void GPS_Correlator::SelectSearchFrequencyOffsets() {
+    coarse_dwell_index++;
+    if (coarse_dwell_index >= COARSE_DWELL_BLOCKS) {
+        coarse_dwell_index = 0;
+        EndCoarseDwell();
+    }
+
+    // Search the frequency offsets within half a bin of the coarse detections
+    const size_t TOTAL_FREQ_OFFSETS = freq_offsets.size();
+    const float Fbin = (float)Fs / (float)block_size;
+    std::fill(is_freq_offset_searched.begin(), is_freq_offset_searched.end(), false);
+    for (const size_t coarse_index: coarse_detection_indices) {
+        const float coarse_freq_offset = freq_offsets[coarse_freq_offset_indices[coarse_index]];
+        for (size_t i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+            if (std::abs(freq_offsets[i] - coarse_freq_offset) <= 0.5f*Fbin) {
+                is_freq_offset_searched[i] = true;
+            }
+        }
+    }
+
+    // Offsets that are no longer searched and don't have a coarse correlation are cleared once
+    for (const size_t i: search_freq_offset_indices) {
+        if (!is_freq_offset_searched[i] && (freq_offset_templates[i].base_index != 0)) {
+            auto& freq_shifted_corr_out = freq_shifted_correlation_output[i];
+            std::fill(freq_shifted_corr_out.begin(), freq_shifted_corr_out.end(), 0.0f);
+            freq_shifted_correlation_peaks[i] = vec_peak_t{};
+        }
+    }
+    search_freq_offset_indices.clear();
+    for (size_t i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+        if (is_freq_offset_searched[i]) {
+            search_freq_offset_indices.push_back(i);
+        }
+    }
+}
+
+void GPS_Correlator::StartBlock() {
+    if (noncoherent_index != 0) {
+        return;
+    }
+
+    noncoherent_count = noncoherent_count_request;
+    if (noncoherent_count <= 1) {
+        return;
+    }
+
+    if (freq_shifted_noncoherent_power.empty()) {
+        const size_t TOTAL_FREQ_OFFSETS = freq_offsets.size();
+        for (size_t i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
+            freq_shifted_noncoherent_power.push_back({ (size_t)block_size, SIMD_ALIGN_AMOUNT });
+        }
+    }
+
+    for (auto& power: freq_shifted_noncoherent_power) {
+        std::fill(power.begin(), power.end(), 0.0f);
+    }
+}
+
+template <int N_FIXED>
+void GPS_Correlator::CalculateCorrelation(const size_t freq_offset_index, std::complex<float>* x_in_ifft) {
+    const int N = (N_FIXED > 0) ? N_FIXED : block_size;
+    auto* freq_shifted_corr_out = freq_shifted_correlation_output[freq_offset_index].data();
+    const float K_norm_fft = 1.0f / (float)(2*N + 1);
+    if (!is_fftshift_folded) {
+        InplaceFFTShift<std::complex<float>>(tcb::span(x_in_ifft, (size_t)N));
+    }
+
+    // Peak search is deferred until the end of the integration window
+    if (noncoherent_count > 1) {
+        auto* power = freq_shifted_noncoherent_power[freq_offset_index].data();
+        c32_vec_mag_accumulate_auto<N_FIXED>(x_in_ifft, power, N, K_norm_fft*K_norm_fft);
+        return;
+    }
+
+    freq_shifted_correlation_peaks[freq_offset_index] = c32_vec_mag_peak_auto<N_FIXED>(
+        x_in_ifft, freq_shifted_corr_out, N, 
+        K_norm_fft, false, peak_exclusion);
+}
+
+template <int N_FIXED, int D_FIXED>
+void GPS_Correlator::EndBlock() {
+    noncoherent_index++;
+    if (noncoherent_index < noncoherent_count) {
+        return;
+    }
+    noncoherent_index = 0;
+
+    if (noncoherent_count > 1) {
+        // Average magnitude has the same scale as the correlation of a single block
+        const int N = (N_FIXED > 0) ? N_FIXED : block_size;
+        const int D = (D_FIXED > 0) ? D_FIXED : (int)freq_offsets.size();
+        const float K_norm = 1.0f / (float)noncoherent_count;
+        for (int i = 0; i < D; i++) {
+            const auto* power = freq_shifted_noncoherent_power[i].data();
+            auto* freq_shifted_corr_out = freq_shifted_correlation_output[i].data();
+            for (int j = 0; j < N; j++) {
+                freq_shifted_corr_out[j] = std::sqrt(power[j]*K_norm);
+            }
+            freq_shifted_correlation_peaks[i] = f32_vec_peak_auto<N_FIXED>(
+                freq_shifted_corr_out, N, peak_exclusion);
+        }
+    }
+
+    UpdateBestFrequencyOffset<D_FIXED>();
+}
+
+template <int D_FIXED>
+void GPS_Correlator::UpdateBestFrequencyOffset() {
+    const int D = (D_FIXED > 0) ? D_FIXED : (int)freq_offsets.size();
 
     // Find best frequency offset
     float largest_peak = 0.0f;
     int freq_offset_index = 0;
-    for (int i = 0; i < TOTAL_FREQ_OFFSETS; i++) {
-        auto& y_corr = freq_shifted_correlation_output[i];
-        float v_max = 0.0f;
-        for (int j = 0; j < block_size; j++) {
-            v_max = std::max(v_max, y_corr[j]);
-        }
+    const auto* peaks = freq_shifted_correlation_peaks.data();
+    for (int i = 0; i < D; i++) {
+        const float v_max = peaks[i].value;
         if (v_max > largest_peak) {
             largest_peak = v_max;
             freq_offset_index = i;
@@ -120,22 +644,93 @@ void GPS_Correlator::Process(tcb::span<const std::complex<float>> x_in_fft) {
     freq_offset_index_histogram->PushIndex(freq_offset_index);
 }
 
+void GPS_Correlator::AppendMultiplyTask(
+    const std::complex<float>* x, 
+    const FrequencyTemplate& freq_template, 
+    std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    // y[k] = x[k] * base[k-m]
+    const auto* base = freq_shifted_prn_ffts[freq_template.base_index].data();
+    AppendRotatedMultiplyTask(x, base, freq_template.base_start, y, tasks);
+}
+
+void GPS_Correlator::AppendRotatedMultiplyTask(
+    const std::complex<float>* x, 
+    const std::complex<float>* base, const int base_start,
+    std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    // base is only stored once so the rotation wraps back to base[0] after N-base_start samples
+    tasks.push_back({ x, base+base_start, y, base, block_size-base_start });
+}
+
+void GPS_Correlator::AppendMultiplyTask(
+    const GPS_InputBank& input_bank, 
+    const FrequencyTemplate& freq_template, 
+    std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    // y[k] = x_h[k+m] * prn[k]
+    const auto* prn = freq_shifted_prn_ffts[0].data();
+    const auto* x = (freq_template.base_index == 0) ? input_bank.base.data() : input_bank.half_bin.data();
+    tasks.push_back({ x+freq_template.base_start, prn, y });
+}
+
+void GPS_Correlator::AppendCoarseMultiplyTask(
+    const std::complex<float>* x, 
+    const FrequencyTemplate& freq_template, 
+    std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    // y[k'] = x[k] * base[k-m] over the central half of the spectrum
+    // k' = [0,N/4) is k = [0,N/4) and k' = [N/4,N/2) is k = [3N/4,N)
+    const int N_quarter = block_size/4;
+    const auto* base = freq_shifted_prn_ffts[freq_template.base_index].data();
+    AppendRotatedMultiplyTask(x, base, freq_template.base_start, y, tasks);
+    AppendRotatedMultiplyTask(x+3*N_quarter, base, freq_template.coarse_base_start, y+N_quarter, tasks);
+}
+
+void GPS_Correlator::AppendCoarseMultiplyTask(
+    const GPS_InputBank& input_bank, 
+    const FrequencyTemplate& freq_template, 
+    std::complex<float>* y, std::vector<c32_vec_mul_task_t>& tasks) 
+{
+    // y[k'] = x_h[k+m] * prn[k] over the central half of the spectrum
+    // The doubled input spectrum means both halves are contiguous
+    const int N_quarter = block_size/4;
+    const auto* prn = freq_shifted_prn_ffts[0].data();
+    const auto* x = (freq_template.base_index == 0) ? input_bank.base.data() : input_bank.half_bin.data();
+    x += freq_template.base_start;
+    tasks.push_back({ x, prn, y });
+    tasks.push_back({ x+3*N_quarter, prn+3*N_quarter, y+N_quarter });
+}
+
 int GPS_Correlator::GetModeFrequencyOffsetIndex() const {
     return freq_offset_index_histogram->GetMode();
 }
 
+int GPS_Correlator::GetCodePhase(const int peak_index) const {
+    // Correlation output is fftshifted and the template is the reversed prn code
+    return (peak_index + block_size/2 + 1) % block_size;
+}
+
 void GPS_Correlator::FindCorrelationPeak(tcb::span<const float> x, int& index, float& value) {
-        int peak_index = 0;
-        float peak_value = x[0];
-        const size_t N = x.size();
-        for (size_t i = 0; i < N; i++) {
-            const float v = x[i];
-            if (v > peak_value) {
-                peak_value = v;
-                peak_index = (int)i;
-            }
-        }
+    int peak_index = 0;
+    float peak_value = x[0];
+    f32_vec_argmax_auto(x.data(), (int)x.size(), 0, peak_index, peak_value);
+    index = peak_index;
+    value = peak_value;
+}
+
+template <int N, int D>
+GPS_CorrelatorFixed<N,D>::GPS_CorrelatorFixed(
+    tcb::span<uint8_t> _logical_prn_code, 
+    const int _block_size, 
+    const int _Fcode, const int _Fs, const int _Fdev_max,
+    const GPS_TemplateMode _template_mode)
+:   GPS_Correlator(_logical_prn_code, _block_size, _Fcode, _Fs, _Fdev_max, _template_mode)
+{
+    assert(block_size == N);
+    assert((int)freq_offsets.size() == D);
+}
 
-        index = peak_index;
-        value = peak_value;
-    }
\ No newline at end of file
+template class GPS_CorrelatorFixed<2048, 25>;
+template class GPS_CorrelatorFixed<4096, 25>;
+template class GPS_CorrelatorFixed<8192, 25>;
\ No newline at end of file
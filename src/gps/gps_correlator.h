@@ -5,27 +5,100 @@
 #include <vector>
 #include <memory>
 #include "histogram.h"
+#include "dsp/calculate_fft.h"
+#include "dsp/simd/c32_vec_mag_peak.h"
+#include "dsp/simd/c32_vec_mul.h"
 #include "utility/aligned_vector.h"
 #include "utility/joint_allocate.h"
 #include "utility/span.h"
 
+// How we store the frequency shifted prn code spectrums
+enum class GPS_TemplateMode {
+    // Store a separate spectrum for each frequency offset
+    FULL,
+    // Store a base spectrum for whole and half fft bin offsets 
+    // Other frequency offsets are a circular rotation of these 
+    ROTATE,
+    // Store only the unshifted spectrum and take frequency shifted inputs from a shared GPS_InputBank
+    INPUT_BANK,
+};
+
+// Frequency shifted input spectrums that are shared by every correlator
+// Frequency offset (m + h/2)*Fbin is the spectrum of the input shifted by h half fft bins rotated by m bins 
+// NOTE: Each spectrum is stored twice so any rotation is contiguous, i.e. x[k+m] = x_double[m+k]
+struct GPS_InputBank {
+    tcb::span<const std::complex<float>> base;
+    tcb::span<const std::complex<float>> half_bin;
+};
+
 class GPS_Correlator 
 {
-private:
+protected:
     const int block_size;
     const int Fcode;
     const int Fs;
     const float Ts;
     const int Fdev_max;
+    GPS_TemplateMode template_mode;
 
     // frequency shifted correlation data
+    // NOTE: Each frequency offset uses a base spectrum that is rotated by some amount of fft bins
+    //       Offsets with half a cycle of phase rotation per block use the alternating input spectrum
+    //       With an input bank the base index selects the half fft bin shifted input instead
+    // NOTE: Start indices of the rotation are precomputed so the per block path has no modulo arithmetic
+    struct FrequencyTemplate {
+        int base_index;
+        int rotation;
+        bool is_alternating_input;
+        // rotated base spectrum or input bank start for k = 0
+        int base_start = 0;
+        // rotated base spectrum start for k = 3N/4 in the coarse search
+        int coarse_base_start = 0;
+    };
     std::vector<float> freq_offsets;
-    std::vector<AlignedVector<std::complex<float>>> freq_shifted_prn_codes;
+    std::vector<FrequencyTemplate> freq_offset_templates;
+    // NOTE: Rotated base spectrums are stored once and multiply tasks wrap around to their start
     std::vector<AlignedVector<std::complex<float>>> freq_shifted_prn_ffts;
     std::vector<AlignedVector<float>> freq_shifted_correlation_output;
+    std::vector<vec_peak_t> freq_shifted_correlation_peaks;
+    // second peak must be at least a chip away from the main peak
+    int peak_exclusion;
+    // fftshift is applied to the templates instead of each correlation output
+    bool is_fftshift_folded;
 
+    // non-coherent integration of |correlation|^2 over multiple blocks
+    // NOTE: A change in the number of blocks is applied at the start of the next integration window
+    int noncoherent_count = 1;
+    int noncoherent_count_request = 1;
+    int noncoherent_index = 0;
+    std::vector<AlignedVector<float>> freq_shifted_noncoherent_power;
+
+    // two stage search
+    // A coarse stage correlates whole fft bin offsets using the central half of the spectrum
+    // |coarse correlation|^2 is integrated over a dwell of a few blocks and its peaks are tested against the
+    // mean of every coarse correlation. Only frequency offsets near the coarse detections of the last dwell
+    // get a full resolution correlation and without any detections the full resolution search is skipped
+    // NOTE: Non-coherent integration needs the same frequency offsets every block so it uses a full search
+    bool is_coarse_search_supported;
+    bool is_two_stage_search_request = false;
+    bool is_coarse_search = false;
+    int coarse_block_size;
+    std::vector<size_t> coarse_freq_offset_indices;
+    int coarse_dwell_index = 0;
+    std::vector<AlignedVector<float>> coarse_noncoherent_power;
+    std::vector<vec_peak_t> coarse_dwell_peaks;
+    std::vector<size_t> coarse_detection_indices;
+    std::vector<size_t> search_freq_offset_indices;
+    std::vector<bool> is_freq_offset_searched;
+
+    // Templates are multiplied in groups with c32_vec_mul_tiled_auto so tiles of the input spectrum are reused
+    // corr_buf is [multiply_group_size][block_size]
+    int multiply_group_size;
+    std::vector<c32_vec_mul_task_t> multiply_tasks;
     AlignedVector<std::complex<float>> corr_buf;
     AlignedVector<std::complex<float>> ifft_buf;
+    FFT_Plan ifft_plan;
+    FFT_Plan coarse_ifft_plan;
     // frequency offset and peak detection 
     int best_frequency_offset_index = 0;
     std::unique_ptr<Histogram> freq_offset_index_histogram;
@@ -33,12 +106,144 @@ public:
     GPS_Correlator(
         tcb::span<uint8_t> _logical_prn_code, 
         const int _block_size, 
-        const int _Fcode, const int _Fs, const int _Fdev_max);
+        const int _Fcode, const int _Fs, const int _Fdev_max,
+        const GPS_TemplateMode _template_mode=GPS_TemplateMode::FULL);
+    // x_in_fft_alt is the spectrum of blocks that were coherently folded with alternating signs
+    // It is used by frequency offsets which rotate by half a cycle every block
     void Process(tcb::span<const std::complex<float>> x_in_fft);
+    virtual ~GPS_Correlator() = default;
+    virtual void Process(tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt);
+    virtual void Process(const GPS_InputBank& input_bank);
+    // Batched processing where the caller performs the multiplies and the ifft for every searched frequency offset
+    // 1. StartCoarseSearch
+    // 2. AppendCoarseMultiplyTasks then CalculateCoarseCorrelations: y_out and x_in_ifft are [end-start][GetCoarseBlockSize()]
+    // 3. StartSearch: selects the frequency offsets for the full resolution search
+    // 4. AppendMultiplyTasks then CalculateCorrelations: y_out and x_in_ifft are [end-start][block_size]
+    // 5. EndSearch
+    // NOTE: Steps 2 and 4 work on a range [start, end) of GetTotalCoarseCorrelations() or GetTotalSearchCorrelations()
+    //       Disjoint ranges can run concurrently so the frequency offsets of one correlator can be spread across threads
+    // NOTE: The coarse stage must be started even if the two stage search is disabled
+    // NOTE: Tasks are appended so the caller can run the tasks of many correlators that share an input spectrum 
+    //       in one call to c32_vec_mul_tiled_auto. Coarse tasks have length GetCoarseMultiplySize() 
+    //       and full resolution tasks have length block_size
+    void StartCoarseSearch();
+    void AppendCoarseMultiplyTasks(
+        tcb::span<const std::complex<float>> x_in_fft, tcb::span<std::complex<float>> y_out, 
+        const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendCoarseMultiplyTasks(
+        const GPS_InputBank& input_bank, tcb::span<std::complex<float>> y_out, 
+        const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks);
+    virtual void CalculateCoarseCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end);
+    void StartSearch();
+    void AppendMultiplyTasks(
+        tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt, 
+        tcb::span<std::complex<float>> y_out, 
+        const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendMultiplyTasks(
+        const GPS_InputBank& input_bank, tcb::span<std::complex<float>> y_out, 
+        const size_t start, const size_t end, std::vector<c32_vec_mul_task_t>& tasks);
+    virtual void CalculateCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end);
+    virtual void EndSearch();
     void FindCorrelationPeak(tcb::span<const float> x, int& index, float& value);
 public:
     auto GetBestFrequencyOffsetIndex() const { return best_frequency_offset_index; }
     int GetModeFrequencyOffsetIndex() const;
+    auto& GetFrequencyOffsetHistogram() const { return *freq_offset_index_histogram; }
+    void ResetFrequencyOffsetHistogram() { freq_offset_index_histogram->Reset(); }
+    // Code phase in samples of the correlation peak index so it can be handed over to a tracker
+    int GetCodePhase(const int peak_index) const;
     auto& GetFrequencyOffsets() { return freq_offsets; }
     auto& GetCorrelations() { return freq_shifted_correlation_output; }
-};
\ No newline at end of file
+    auto& GetCorrelationPeaks() { return freq_shifted_correlation_peaks; }
+    auto GetTemplateMode() const { return template_mode; }
+    void SetNonCoherentCount(const int count) { noncoherent_count_request = (count > 1) ? count : 1; }
+    void SetIsTwoStageSearch(const bool is_two_stage) { is_two_stage_search_request = is_two_stage; }
+    int GetCoarseBlockSize() const { return coarse_block_size; }
+    // Each coarse correlation is the product of two quarters of the spectrum
+    int GetCoarseMultiplySize() const { return coarse_block_size/2; }
+    size_t GetTotalCoarseCorrelations() const { return is_coarse_search ? coarse_freq_offset_indices.size() : 0; }
+    size_t GetTotalSearchCorrelations() const { return search_freq_offset_indices.size(); }
+    int GetBlockSize() const { return block_size; }
+    static int GetTotalFrequencyOffsets(const int Fcode, const int Fdev_max);
+protected:
+    // Per block path where N_FIXED and D_FIXED are the block size and number of frequency offsets
+    // A value of 0 uses the runtime value
+    template <int N_FIXED, int D_FIXED>
+    void ProcessImpl(tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt);
+    template <int N_FIXED, int D_FIXED>
+    void ProcessImpl(const GPS_InputBank& input_bank);
+    template <int N_FIXED>
+    void CalculateCoarseCorrelationsImpl(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end);
+    template <int N_FIXED>
+    void CalculateCorrelationsImpl(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end);
+    template <int N_FIXED, int D_FIXED>
+    void EndSearchImpl();
+private:
+    void AppendMultiplyTask(
+        const std::complex<float>* x_in_fft, 
+        const FrequencyTemplate& freq_template, 
+        std::complex<float>* y_out, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendMultiplyTask(
+        const GPS_InputBank& input_bank, 
+        const FrequencyTemplate& freq_template, 
+        std::complex<float>* y_out, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendRotatedMultiplyTask(
+        const std::complex<float>* x_in_fft, 
+        const std::complex<float>* base, const int base_start,
+        std::complex<float>* y_out, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendCoarseMultiplyTask(
+        const std::complex<float>* x_in_fft, 
+        const FrequencyTemplate& freq_template, 
+        std::complex<float>* y_out, std::vector<c32_vec_mul_task_t>& tasks);
+    void AppendCoarseMultiplyTask(
+        const GPS_InputBank& input_bank, 
+        const FrequencyTemplate& freq_template, 
+        std::complex<float>* y_out, std::vector<c32_vec_mul_task_t>& tasks);
+    template <int N_FIXED, int D_FIXED, typename F0, typename F1>
+    void ProcessSearch(F0&& append_coarse_task, F1&& append_task);
+    template <int N_FIXED>
+    void CalculateCoarseCorrelation(const size_t coarse_index, std::complex<float>* x_in_ifft);
+    void EndCoarseDwell();
+    void SelectSearchFrequencyOffsets();
+    void StartBlock();
+    template <int N_FIXED>
+    void CalculateCorrelation(const size_t freq_offset_index, std::complex<float>* x_in_ifft);
+    template <int N_FIXED, int D_FIXED>
+    void EndBlock();
+    template <int D_FIXED>
+    void UpdateBestFrequencyOffset();
+};
+
+// Correlator specialised at compile time on the block size and number of frequency offsets
+// This gives the per block loops and simd kernels fixed trip counts without scalar tails
+template <int N, int D>
+class GPS_CorrelatorFixed final: public GPS_Correlator
+{
+public:
+    GPS_CorrelatorFixed(
+        tcb::span<uint8_t> _logical_prn_code, 
+        const int _block_size, 
+        const int _Fcode, const int _Fs, const int _Fdev_max,
+        const GPS_TemplateMode _template_mode=GPS_TemplateMode::FULL);
+    using GPS_Correlator::Process;
+    void Process(tcb::span<const std::complex<float>> x_in_fft, tcb::span<const std::complex<float>> x_in_fft_alt) override { 
+        ProcessImpl<N,D>(x_in_fft, x_in_fft_alt); 
+    }
+    void Process(const GPS_InputBank& input_bank) override { 
+        ProcessImpl<N,D>(input_bank); 
+    }
+    void CalculateCoarseCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) override {
+        CalculateCoarseCorrelationsImpl<N>(x_in_ifft, start, end);
+    }
+    void CalculateCorrelations(tcb::span<std::complex<float>> x_in_ifft, const size_t start, const size_t end) override {
+        CalculateCorrelationsImpl<N>(x_in_ifft, start, end);
+    }
+    void EndSearch() override {
+        EndSearchImpl<N,D>();
+    }
+};
+
+// Sample rates of 2.048, 4.096 and 8.192MHz with a 6kHz frequency search in 500Hz steps
+extern template class GPS_CorrelatorFixed<2048, 25>;
+extern template class GPS_CorrelatorFixed<4096, 25>;
+extern template class GPS_CorrelatorFixed<8192, 25>;
\ No newline at end of file
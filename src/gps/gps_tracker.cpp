@@ -0,0 +1,148 @@
+#include "gps_tracker.h"
+#include <assert.h>
+#include <cmath>
+#include "dsp/simd/c32_vec_mul.h"
+#include "dsp/simd/c32_f32_vec_dot.h"
+#include "dsp/simd/c32_vec_oscillator.h"
+
+// NOTE: AVX2 is 256bit = 32bytes
+constexpr size_t SIMD_ALIGN_AMOUNT = 32u;
+constexpr float PI = 3.14159265f;
+
+// Regenerate the carrier wipe-off when the frequency estimate drifts too far
+constexpr float CARRIER_TABLE_TOLERANCE = 10.0f;
+// Loop gains for the delay lock loop (samples) and frequency lock loop (Hz)
+constexpr float DLL_GAIN = 0.2f;
+constexpr float FLL_GAIN = 0.1f;
+// Lock is lost when the average prompt power falls below this multiple of the noise power
+constexpr float LOCK_THRESHOLD = 2.5f;
+constexpr float LOCK_AVERAGE_BETA = 0.05f;
+constexpr int LOCK_MIN_BLOCKS = 20;
+
+GPS_Tracker::GPS_Tracker(
+    tcb::span<const uint8_t> _logical_prn_code,
+    const int _block_size, const int _Fs)
+:   block_size(_block_size), Fs(_Fs)
+{
+    const int N_src = (int)_logical_prn_code.size();
+    const int N_dst = block_size;
+    early_late_spacing = (int)std::round(0.5f * (float)N_dst / (float)N_src);
+    early_late_spacing = (early_late_spacing > 0) ? early_late_spacing : 1;
+
+    // nearest neighbour upsampling of code to sampling frequency
+    // NOTE: Uses the same scaling as the correlator templates so the acquired code phase matches
+    code_replica = AlignedVector<float>(2*block_size, SIMD_ALIGN_AMOUNT);
+    const float x_scale = (float)(N_src-1) / (float)(N_dst-1);
+    for (int i = 0; i < N_dst; i++) {
+        const int i_scaled = (int)((float)i * x_scale);
+        const float v = (float)_logical_prn_code[i_scaled];
+        const float v_norm = 2.0f*v - 1.0f;
+        code_replica[i] = v_norm;
+        code_replica[i+N_dst] = v_norm;
+    }
+
+    carrier_table = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+    wipe_off_buf = AlignedVector<std::complex<float>>(block_size, SIMD_ALIGN_AMOUNT);
+}
+
+void GPS_Tracker::Start(const float _code_phase, const float _carrier_frequency) {
+    is_locked = true;
+    code_phase = _code_phase;
+    carrier_frequency = _carrier_frequency;
+    block_phase = 0.0f;
+    total_blocks_tracked = 0;
+    prev_prompt = 0.0f;
+    prompt_power_average = 0.0f;
+    noise_power_average = 0.0f;
+    UpdateCarrierTable();
+}
+
+void GPS_Tracker::Process(tcb::span<const std::complex<float>> x) {
+    assert(x.size() == (size_t)block_size);
+    if (!is_locked) {
+        return;
+    }
+
+    if (std::abs(carrier_frequency - carrier_table_frequency) > CARRIER_TABLE_TOLERANCE) {
+        UpdateCarrierTable();
+    }
+
+    // carrier wipe-off
+    c32_vec_mul_auto(x.data(), carrier_table.data(), wipe_off_buf.data(), block_size);
+
+    // early/prompt/late correlators and a noise correlator half a code period away
+    const int prompt_shift = (int)std::round(code_phase);
+    early = Correlate(prompt_shift - early_late_spacing);
+    prompt = Correlate(prompt_shift);
+    late = Correlate(prompt_shift + early_late_spacing);
+    const auto noise = Correlate(prompt_shift + block_size/2);
+
+    // Derotate by the carrier phase at the start of this block so the prompt phase is continuous
+    const auto block_rotation = std::polar(1.0f, -block_phase);
+    early *= block_rotation;
+    prompt *= block_rotation;
+    late *= block_rotation;
+    block_phase = std::fmod(block_phase + 2.0f*PI*carrier_table_frequency*(float)block_size/(float)Fs, 2.0f*PI);
+
+    // delay lock loop using normalised early minus late envelope
+    // NOTE: If the early correlator is stronger the signal arrives earlier than our prompt
+    const float early_mag = std::abs(early);
+    const float late_mag = std::abs(late);
+    if ((early_mag + late_mag) > 0.0f) {
+        const float error = (early_mag - late_mag) / (early_mag + late_mag);
+        code_phase -= DLL_GAIN * error * (float)early_late_spacing;
+        code_phase = std::fmod(code_phase + (float)block_size, (float)block_size);
+    }
+
+    // frequency lock loop that is insensitive to data bit transitions
+    if (total_blocks_tracked > 0) {
+        const auto delta = prompt * std::conj(prev_prompt);
+        float cross = delta.imag();
+        float dot = delta.real();
+        if (dot < 0.0f) {
+            cross = -cross;
+            dot = -dot;
+        }
+        const float phase_error = std::atan2(cross, dot);
+        const float T_block = (float)block_size / (float)Fs;
+        const float frequency_error = phase_error / (2.0f*PI*T_block);
+        carrier_frequency += FLL_GAIN * frequency_error;
+    }
+    prev_prompt = prompt;
+
+    // lock detection
+    const float prompt_power = std::norm(prompt);
+    const float noise_power = std::norm(noise);
+    if (total_blocks_tracked == 0) {
+        prompt_power_average = prompt_power;
+        noise_power_average = noise_power;
+    } else {
+        prompt_power_average += LOCK_AVERAGE_BETA*(prompt_power - prompt_power_average);
+        noise_power_average += LOCK_AVERAGE_BETA*(noise_power - noise_power_average);
+    }
+    total_blocks_tracked++;
+
+    if ((total_blocks_tracked >= LOCK_MIN_BLOCKS) && (GetLockRatio() < LOCK_THRESHOLD)) {
+        is_locked = false;
+    }
+}
+
+float GPS_Tracker::GetLockRatio() const {
+    if (noise_power_average <= 0.0f) {
+        return 0.0f;
+    }
+    return prompt_power_average / noise_power_average;
+}
+
+void GPS_Tracker::UpdateCarrierTable() {
+    carrier_table_frequency = carrier_frequency;
+    const float step = -2.0f * PI * carrier_table_frequency / (float)Fs;
+    c32_vec_oscillator_auto(carrier_table.data(), 0.0f, step, block_size);
+}
+
+std::complex<float> GPS_Tracker::Correlate(const int shift) {
+    // replica[i] = code[(i-shift) % N] = code_replica[N-shift+i]
+    const int N = block_size;
+    const int offset = N - (((shift % N) + N) % N);
+    return c32_f32_vec_dot_auto(wipe_off_buf.data(), &code_replica[offset], N);
+}
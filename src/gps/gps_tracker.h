@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <complex>
+#include "utility/aligned_vector.h"
+#include "utility/span.h"
+
+// Track the code phase and carrier frequency of an acquired PRN with time domain correlators
+// This replaces the fft search once the PRN is locked
+class GPS_Tracker
+{
+private:
+    const int block_size;
+    const int Fs;
+    // half a chip spacing between early/prompt/late correlators
+    int early_late_spacing;
+
+    // upsampled prn code repeated twice so any circular shift is contiguous
+    AlignedVector<float> code_replica;
+    // carrier wipe-off for the current carrier frequency estimate
+    AlignedVector<std::complex<float>> carrier_table;
+    float carrier_table_frequency = 0.0f;
+    AlignedVector<std::complex<float>> wipe_off_buf;
+
+    // tracking state
+    bool is_locked = false;
+    float code_phase = 0.0f;
+    float carrier_frequency = 0.0f;
+    float block_phase = 0.0f;
+    int total_blocks_tracked = 0;
+    std::complex<float> prev_prompt = 0.0f;
+    // lock detection uses the prompt power against a correlator that is half a code period away
+    float prompt_power_average = 0.0f;
+    float noise_power_average = 0.0f;
+    // correlator outputs
+    std::complex<float> early = 0.0f;
+    std::complex<float> prompt = 0.0f;
+    std::complex<float> late = 0.0f;
+public:
+    GPS_Tracker(
+        tcb::span<const uint8_t> _logical_prn_code,
+        const int _block_size, const int _Fs);
+    void Start(const float _code_phase, const float _carrier_frequency);
+    void Stop() { is_locked = false; }
+    void Process(tcb::span<const std::complex<float>> x);
+public:
+    bool GetIsLocked() const { return is_locked; }
+    float GetCodePhase() const { return code_phase; }
+    float GetCarrierFrequency() const { return carrier_frequency; }
+    float GetLockRatio() const;
+    int GetTotalBlocksTracked() const { return total_blocks_tracked; }
+    auto GetEarly() const { return early; }
+    auto GetPrompt() const { return prompt; }
+    auto GetLate() const { return late; }
+private:
+    void UpdateCarrierTable();
+    std::complex<float> Correlate(const int shift);
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <algorithm>
 #include <assert.h>
 
 // Keep count of the frequeny offset indices
@@ -51,4 +52,17 @@ public:
 
         return max_index;
     }
+
+    int GetCount(const int index) const {
+        assert((index >= 0) && (index < total_indices));
+        return index_counts[index];
+    }
+
+    int GetTotalCounts() const { return total_counts; }
+
+    void Reset() {
+        std::fill(index_counts.begin(), index_counts.end(), 0);
+        total_counts = 0;
+        curr_count_index = 0;
+    }
 };
\ No newline at end of file
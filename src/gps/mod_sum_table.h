@@ -2,7 +2,7 @@
 #include <stdint.h>
 #include <vector>
 
-std::vector<uint8_t> generate_mod_sum_table(const int total_bits) {
+inline std::vector<uint8_t> generate_mod_sum_table(const int total_bits) {
     const uint16_t total_states = (1u << total_bits);
     auto arr = std::vector<uint8_t>((int)total_states);
     for (uint16_t i = 0u; i < total_states; i++) {
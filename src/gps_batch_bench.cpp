@@ -0,0 +1,401 @@
+#define _USE_MATH_DEFINES
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+
+#include "gps/gps_app.h"
+#include "gps/gps_prn_constants.h"
+#include "gps/prn_code.h"
+#include "utility/aligned_vector.h"
+#include "utility/span.h"
+#include "utility/getopt/getopt.h"
+
+void usage() {
+    fprintf(stderr,
+        "gps_batch_bench, Checks that GPS_App::ProcessBatch matches GPS_App::Process and compares their speed\n\n"
+        "\t[-m mode (default: all)]\n"
+        "\t    all: Run conformance checks then benchmarks\n"
+        "\t    check: Only run conformance checks\n"
+        "\t    bench: Only run benchmarks\n"
+        "\t[-f sampling frequency (default: 2048000)]\n"
+        "\t[-t total correlation threads (default: hardware concurrency)]\n"
+        "\t[-n total blocks per check (default: 32)]\n"
+        "\t[-b benchmark batch size (default: 8)]\n"
+        "\t[-r benchmark blocks per measurement (default: 64)]\n"
+        "\t[-s random seed (default: 0)]\n"
+        "\t[-h (show usage)]\n"
+    );
+}
+
+constexpr struct {
+    int Fcode = 1000;
+    int Fdev = 6000;
+} GPS_FIXED_PARAMS;
+
+constexpr GPS_TemplateMode TEMPLATE_MODES[] = {
+    GPS_TemplateMode::FULL, GPS_TemplateMode::ROTATE, GPS_TemplateMode::INPUT_BANK,
+};
+// Batch sizes that do and don't line up with coherent folding and the end of the input
+constexpr size_t CHECK_BATCH_SIZES[] = { 1, 3, 4, 8 };
+constexpr int TOTAL_BENCH_MEASUREMENTS = 5;
+// Prns that get triggered by hand when correlators aren't always correlating
+// NOTE: Triggers outlast smaller batches so correlators carry on into the next batch
+constexpr size_t TOTAL_TRIGGERED_PRNS = 2;
+constexpr int TRIGGER_BLOCKS = 6;
+
+using cf = std::complex<float>;
+using rng_t = std::mt19937;
+using bench_clock = std::chrono::steady_clock;
+
+static const char* GetTemplateModeName(const GPS_TemplateMode mode) {
+    switch (mode) {
+    case GPS_TemplateMode::FULL:        return "full";
+    case GPS_TemplateMode::ROTATE:      return "rotate";
+    case GPS_TemplateMode::INPUT_BANK:  return "input_bank";
+    default:                            return "unknown";
+    }
+}
+
+// Settings of GPS_App that change which path ProcessBatch takes
+struct AppConfig {
+    const char* name;
+    bool is_always_correlate;
+    bool is_batch_correlate;
+    bool is_two_stage_search;
+    int noncoherent_count;
+    int coherent_fold_count;
+    bool is_tracking;
+};
+
+constexpr AppConfig CHECK_CONFIGS[] = {
+    { "always",             true,  true,  false, 1, 1, false },
+    { "per_prn",            true,  false, false, 1, 1, false },
+    { "triggered",          false, true,  false, 1, 1, false },
+    { "two_stage",          true,  true,  true,  1, 1, false },
+    { "noncoherent",        true,  true,  false, 2, 1, false },
+    { "fold",               true,  true,  false, 1, 2, false },
+    { "tracking",           true,  true,  false, 1, 1, true  },
+    { "fold_tracking",      false, true,  false, 1, 2, true  },
+    { "two_stage_tracking", true,  true,  true,  1, 1, true  },
+};
+
+struct Satellite {
+    int prn_index;
+    float code_phase;
+    float doppler;
+    float amplitude;
+};
+
+// Strong enough to be acquired and tracked within a few blocks
+constexpr Satellite SATELLITES[] = {
+    { 4,  300.0f,  1500.0f, 0.5f },
+    { 11, 1234.5f, -2750.0f, 0.4f },
+    { 23, 77.0f,   500.0f,  0.3f },
+};
+
+struct Context {
+    rng_t rng;
+    int Fs;
+    int total_threads;
+    int total_check_blocks;
+    size_t bench_batch_size;
+    int bench_blocks;
+    int total_failures = 0;
+};
+
+// A few satellites in unit variance noise
+static AlignedVector<cf> GenerateSignal(Context& ctx, const int block_size, const int total_blocks) {
+    const size_t N = (size_t)block_size*(size_t)total_blocks;
+    auto x = AlignedVector<cf>(N, 32);
+    auto noise = std::normal_distribution<float>(0.0f, 1.0f);
+    for (size_t i = 0; i < N; i++) {
+        x[i] = cf(noise(ctx.rng), noise(ctx.rng));
+    }
+
+    auto code = std::vector<uint8_t>(PRN_CODE_LENGTH);
+    for (const auto& sat: SATELLITES) {
+        generate_prn_code<uint8_t>(code, PRN_OUTPUT_TAPS[sat.prn_index]);
+        const double chip_rate = double(PRN_CODE_LENGTH)/double(block_size);
+        const double phase_step = 2.0*M_PI*double(sat.doppler)/double(ctx.Fs);
+        for (size_t i = 0; i < N; i++) {
+            const int chip = int(std::floor((double(i)+double(sat.code_phase))*chip_rate)) % PRN_CODE_LENGTH;
+            const float value = code[chip] ? sat.amplitude : -sat.amplitude;
+            const double phase = phase_step*double(i);
+            x[i] += cf(value*float(std::cos(phase)), value*float(std::sin(phase)));
+        }
+    }
+    return x;
+}
+
+static std::unique_ptr<GPS_App> CreateApp(const Context& ctx, const GPS_TemplateMode mode, const AppConfig& config) {
+    auto app = std::make_unique<GPS_App>(
+        ctx.Fs, GPS_FIXED_PARAMS.Fcode, GPS_FIXED_PARAMS.Fdev, mode, (size_t)ctx.total_threads);
+    app->GetIsAlwaysCorrelate() = config.is_always_correlate;
+    app->GetIsBatchCorrelate() = config.is_batch_correlate;
+    app->GetIsTwoStageSearch() = config.is_two_stage_search;
+    app->GetNonCoherentCount() = config.noncoherent_count;
+    app->GetCoherentFoldCount() = config.coherent_fold_count;
+    app->GetIsTracking() = config.is_tracking;
+    return app;
+}
+
+// Cycle through the prns so correlators start and stop between batches
+static void TriggerCorrelators(GPS_App& app, const size_t batch_index) {
+    auto& flags = app.GetCorrelatorTriggerFlags();
+    for (size_t i = 0; i < TOTAL_TRIGGERED_PRNS; i++) {
+        const size_t sat_index = (batch_index+i) % std::size(SATELLITES);
+        flags[(size_t)SATELLITES[sat_index].prn_index] = TRIGGER_BLOCKS;
+    }
+}
+
+// Everything a caller can read back from GPS_App has to be bit identical
+static bool GetIsAppEqual(GPS_App& a, GPS_App& b, const char*& reason) {
+    const size_t N = (size_t)a.GetBlockSize();
+    if (a.GetTotalBlocksRead() != b.GetTotalBlocksRead()) {
+        reason = "total blocks read";
+        return false;
+    }
+    if (a.GetCorrelatorTriggerFlags() != b.GetCorrelatorTriggerFlags()) {
+        reason = "trigger flags";
+        return false;
+    }
+    auto& correlators_a = a.GetCorrelators();
+    auto& correlators_b = b.GetCorrelators();
+    for (size_t i = 0; i < correlators_a.size(); i++) {
+        auto& corr_a = *correlators_a[i];
+        auto& corr_b = *correlators_b[i];
+        if (corr_a.GetBestFrequencyOffsetIndex() != corr_b.GetBestFrequencyOffsetIndex()) {
+            reason = "best frequency offset";
+            return false;
+        }
+        auto& outputs_a = corr_a.GetCorrelations();
+        auto& outputs_b = corr_b.GetCorrelations();
+        for (size_t j = 0; j < outputs_a.size(); j++) {
+            if (memcmp(outputs_a[j].data(), outputs_b[j].data(), N*sizeof(float)) != 0) {
+                reason = "correlation";
+                return false;
+            }
+        }
+        auto& peaks_a = corr_a.GetCorrelationPeaks();
+        auto& peaks_b = corr_b.GetCorrelationPeaks();
+        for (size_t j = 0; j < peaks_a.size(); j++) {
+            if ((peaks_a[j].index != peaks_b[j].index) || (peaks_a[j].value != peaks_b[j].value)) {
+                reason = "correlation peak";
+                return false;
+            }
+        }
+    }
+    auto& trackers_a = a.GetTrackers();
+    auto& trackers_b = b.GetTrackers();
+    for (size_t i = 0; i < trackers_a.size(); i++) {
+        const auto& tracker_a = trackers_a[i];
+        const auto& tracker_b = trackers_b[i];
+        if ((tracker_a.GetIsLocked() != tracker_b.GetIsLocked()) ||
+            (tracker_a.GetCodePhase() != tracker_b.GetCodePhase()) ||
+            (tracker_a.GetCarrierFrequency() != tracker_b.GetCarrierFrequency()) ||
+            (tracker_a.GetPrompt() != tracker_b.GetPrompt()))
+        {
+            reason = "tracker";
+            return false;
+        }
+    }
+    return true;
+}
+
+static void RunCheck(Context& ctx, const GPS_TemplateMode mode, const AppConfig& config, const size_t batch_size) {
+    auto app_ref = CreateApp(ctx, mode, config);
+    auto app = CreateApp(ctx, mode, config);
+    const int block_size = app->GetBlockSize();
+    const size_t N = (size_t)block_size;
+    const size_t total_blocks = (size_t)ctx.total_check_blocks;
+    auto x = GenerateSignal(ctx, block_size, ctx.total_check_blocks);
+
+    const char* reason = nullptr;
+    size_t fail_block = 0;
+    size_t batch_index = 0;
+    for (size_t start = 0; start < total_blocks; start += batch_size, batch_index++) {
+        const size_t n_blocks = std::min(batch_size, total_blocks-start);
+        if (!config.is_always_correlate) {
+            TriggerCorrelators(*app_ref, batch_index);
+            TriggerCorrelators(*app, batch_index);
+        }
+        for (size_t i = 0; i < n_blocks; i++) {
+            app_ref->Process(tcb::span<const cf>(&x[(start+i)*N], N));
+        }
+        app->ProcessBatch(tcb::span<const cf>(&x[start*N], n_blocks*N), n_blocks);
+        if (!GetIsAppEqual(*app_ref, *app, reason)) {
+            fail_block = start;
+            break;
+        }
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s/%s", GetTemplateModeName(mode), config.name);
+    if (reason == nullptr) {
+        printf("[check] %-30s batch=%zu ok (%zu blocks)\n", label, batch_size, total_blocks);
+    } else {
+        printf("[check] %-30s batch=%zu FAILED on %s in batch starting at block %zu\n",
+            label, batch_size, reason, fail_block);
+        ctx.total_failures++;
+    }
+}
+
+// Best of a few measurements since other processes can only make it slower
+template <typename F>
+static double MeasureMicrosecondsPerBlock(const Context& ctx, F&& process) {
+    double best_us = 0.0;
+    for (int i = 0; i < TOTAL_BENCH_MEASUREMENTS; i++) {
+        const auto start = bench_clock::now();
+        process();
+        const auto end = bench_clock::now();
+        const double us = std::chrono::duration<double, std::micro>(end-start).count() / double(ctx.bench_blocks);
+        best_us = (i == 0) ? us : std::min(best_us, us);
+    }
+    return best_us;
+}
+
+static void RunBench(Context& ctx, const GPS_TemplateMode mode, const AppConfig& config) {
+    auto app_ref = CreateApp(ctx, mode, config);
+    auto app = CreateApp(ctx, mode, config);
+    const int block_size = app->GetBlockSize();
+    const size_t N = (size_t)block_size;
+    const size_t total_blocks = (size_t)ctx.bench_blocks;
+    const size_t batch_size = ctx.bench_batch_size;
+    auto x = GenerateSignal(ctx, block_size, ctx.bench_blocks);
+
+    const double process_us = MeasureMicrosecondsPerBlock(ctx, [&]() {
+        for (size_t start = 0, batch_index = 0; start < total_blocks; start += batch_size, batch_index++) {
+            if (!config.is_always_correlate) {
+                TriggerCorrelators(*app_ref, batch_index);
+            }
+            const size_t n_blocks = std::min(batch_size, total_blocks-start);
+            for (size_t i = 0; i < n_blocks; i++) {
+                app_ref->Process(tcb::span<const cf>(&x[(start+i)*N], N));
+            }
+        }
+    });
+    const double batch_us = MeasureMicrosecondsPerBlock(ctx, [&]() {
+        for (size_t start = 0, batch_index = 0; start < total_blocks; start += batch_size, batch_index++) {
+            if (!config.is_always_correlate) {
+                TriggerCorrelators(*app, batch_index);
+            }
+            const size_t n_blocks = std::min(batch_size, total_blocks-start);
+            app->ProcessBatch(tcb::span<const cf>(&x[start*N], n_blocks*N), n_blocks);
+        }
+    });
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s/%s", GetTemplateModeName(mode), config.name);
+    printf("[bench] %-30s Process=%9.1fus/block ProcessBatch(%zu)=%9.1fus/block speedup=%.2fx\n",
+        label, process_us, batch_size, batch_us, process_us/batch_us);
+}
+
+int main(int argc, char** argv) {
+    const char* mode = "all";
+    int Fs = 2048000;
+    int total_threads = 0;
+    int total_check_blocks = 32;
+    int bench_batch_size = 8;
+    int bench_blocks = 64;
+    int seed = 0;
+
+    int opt;
+    while ((opt = getopt_custom(argc, argv, "m:f:t:n:b:r:s:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            mode = optarg;
+            break;
+        case 'f':
+            Fs = (int)atof(optarg);
+            break;
+        case 't':
+            total_threads = (int)atof(optarg);
+            break;
+        case 'n':
+            total_check_blocks = (int)atof(optarg);
+            break;
+        case 'b':
+            bench_batch_size = (int)atof(optarg);
+            break;
+        case 'r':
+            bench_blocks = (int)atof(optarg);
+            break;
+        case 's':
+            seed = (int)atof(optarg);
+            break;
+        case 'h':
+        default:
+            usage();
+            return 0;
+        }
+    }
+
+    const bool is_all = strcmp(mode, "all") == 0;
+    const bool is_check = is_all || (strcmp(mode, "check") == 0);
+    const bool is_bench = is_all || (strcmp(mode, "bench") == 0);
+    if (!is_check && !is_bench) {
+        fprintf(stderr, "Got invalid mode '%s'\n", mode);
+        return 1;
+    }
+    if ((Fs <= 0) || ((Fs % GPS_FIXED_PARAMS.Fcode) != 0)) {
+        fprintf(stderr, "Got invalid sampling frequency %d which isn't a positive multiple of %d\n",
+            Fs, GPS_FIXED_PARAMS.Fcode);
+        return 1;
+    }
+    if (total_threads < 0) {
+        fprintf(stderr, "Got invalid total threads %d < 0\n", total_threads);
+        return 1;
+    }
+    if (total_check_blocks <= 0) {
+        fprintf(stderr, "Got invalid total check blocks %d <= 0\n", total_check_blocks);
+        return 1;
+    }
+    if (bench_batch_size <= 0) {
+        fprintf(stderr, "Got invalid benchmark batch size %d <= 0\n", bench_batch_size);
+        return 1;
+    }
+    if (bench_blocks <= 0) {
+        fprintf(stderr, "Got invalid benchmark blocks %d <= 0\n", bench_blocks);
+        return 1;
+    }
+
+    Context ctx;
+    ctx.rng = rng_t(uint32_t(seed));
+    ctx.Fs = Fs;
+    ctx.total_threads = total_threads;
+    ctx.total_check_blocks = total_check_blocks;
+    ctx.bench_batch_size = (size_t)bench_batch_size;
+    ctx.bench_blocks = bench_blocks;
+
+    if (is_check) {
+        for (const auto template_mode: TEMPLATE_MODES) {
+            for (const auto& config: CHECK_CONFIGS) {
+                for (const size_t batch_size: CHECK_BATCH_SIZES) {
+                    RunCheck(ctx, template_mode, config, batch_size);
+                }
+            }
+        }
+    }
+    if (is_bench) {
+        // Every prn correlating and only a few prns correlating take different paths through ProcessBatch
+        for (const auto template_mode: TEMPLATE_MODES) {
+            RunBench(ctx, template_mode, CHECK_CONFIGS[0]);
+            RunBench(ctx, template_mode, CHECK_CONFIGS[2]);
+        }
+    }
+
+    if (ctx.total_failures > 0) {
+        fprintf(stderr, "Got %d failed checks\n", ctx.total_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <complex>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <chrono>
 
 #if defined(_WIN32)
 #include <io.h>
@@ -13,6 +15,9 @@
 #endif
 
 #include "gps/gps_app.h"
+#include "dsp/calculate_fft.h"
+#include "dsp/simd/iq8_vec_convert.h"
+#include "dsp/simd/cpu_features.h"
 
 #include <glfw/glfw3.h>
 #include "imgui.h"
@@ -25,6 +30,8 @@
 #include "utility/getopt/getopt.h"
 #include "utility/aligned_vector.h"
 #include "utility/span.h"
+#include "utility/pipeline.h"
+#include "utility/spsc_ring_buffer.h"
 
 constexpr struct {
     const int Fcode = 1000;
@@ -33,28 +40,26 @@ constexpr struct {
 
 constexpr int SIMD_ALIGN_AMOUNT = 32;
 
-// normalise to -1 to 1
-void convert_int8_to_float(tcb::span<const int8_t> x, tcb::span<float> y, const float G=1.0f) {
-    assert(x.size() == y.size());
-    const size_t N = x.size();
-    const float K = 1.0f/127.0f * G;
-    for (int i = 0; i < N; i++) {
-        float v = static_cast<float>(x[i]);
-        y[i] = v*K;
-    }
-}
-
-// normalise to -1 to 1
-void convert_uint8_to_float(tcb::span<const uint8_t> x, tcb::span<float> y, const float G=1.0f) {
-    assert(x.size() == y.size());
-    const size_t N = x.size();
-    const float K = 1.0f/127.5f * G;
-    for (int i = 0; i < N; i++) {
-        float v = static_cast<float>(x[i]) - 127.5f;
-        y[i] = v*K;
-    }
-}
+// Raw values are normalised to -1 to 1
+constexpr float U8_IQ_BIAS = 127.5f;
+constexpr float U8_IQ_SCALE = 1.0f/127.5f;
+constexpr float S8_IQ_BIAS = 0.0f;
+constexpr float S8_IQ_SCALE = 1.0f/127.0f;
+// Fraction of the measured DC offset of each block that is removed from the next one
+constexpr float DC_REMOVAL_BETA = 0.1f;
+
+// Samples of a block as it goes through the pipeline
+struct Block {
+    AlignedVector<std::complex<uint8_t>> raw;
+    AlignedVector<std::complex<float>> samples;
+    GPS_Spectrum spectrum;
+};
 
+// Reading, conversion, fft and correlation run as separate pipeline stages
+// so the next blocks are read and transformed while the current one is being correlated
+// NOTE: Acquisition statistics are reduced at the end of the correlation stage and the gui is the sink
+//       A separate reader thread drains the input into a ring buffer so a slow block doesn't stall
+//       the input, which for a pipe from a live dongle would otherwise drop samples
 class App 
 {
 private:
@@ -62,64 +67,120 @@ private:
     FILE* fp_in;
     const bool is_u8;
     float extra_gain = 1.0f;
-    bool is_running = false;
-    std::unique_ptr<std::thread> runner_thread;
-
-    AlignedVector<std::complex<uint8_t>> buf_rd_raw_in;
-    AlignedVector<std::complex<float>> buf_rd_float_in;
+    // DC offset of I and Q in raw units
+    // NOTE: With many conversion threads the offset is updated from blocks that finish out of order
+    bool is_remove_dc = false;
+    std::complex<float> dc_offset = 0.0f;
+    std::mutex mutex_dc_offset;
+    const size_t total_convert_threads;
+
+    std::vector<Block> blocks;
     GPS_App gps_app;
+    SPSC_RingBuffer<std::complex<uint8_t>> input_ring;
+    std::unique_ptr<std::thread> reader_thread;
+    Pipeline pipeline;
 public:
-    App(FILE* const _fp_in, const int Fs, const bool _is_u8=false) 
-    : fp_in(_fp_in), is_u8(_is_u8),
-      gps_app(Fs, GPS_FIXED_PARAMS.Fcode, GPS_FIXED_PARAMS.Fdev)
+    App(FILE* const _fp_in, const int Fs, const bool _is_u8=false, 
+        const size_t _total_convert_threads=1, const size_t _total_correlate_threads=0, 
+        const size_t _total_blocks_in_flight=4, const size_t _total_input_blocks=256) 
+    : fp_in(_fp_in), is_u8(_is_u8), total_convert_threads(_total_convert_threads),
+      gps_app(Fs, GPS_FIXED_PARAMS.Fcode, GPS_FIXED_PARAMS.Fdev, GPS_TemplateMode::INPUT_BANK, _total_correlate_threads),
+      input_ring(_total_input_blocks*(size_t)gps_app.GetBlockSize()),
+      pipeline(_total_blocks_in_flight)
     {
         const int N = gps_app.GetBlockSize();
-        buf_rd_raw_in = AlignedVector<std::complex<uint8_t>>(N, SIMD_ALIGN_AMOUNT);
-        buf_rd_float_in = AlignedVector<std::complex<float>>(N, SIMD_ALIGN_AMOUNT);
+        blocks.resize(_total_blocks_in_flight);
+        for (auto& block: blocks) {
+            block.raw = AlignedVector<std::complex<uint8_t>>(N, SIMD_ALIGN_AMOUNT);
+            block.samples = AlignedVector<std::complex<float>>(N, SIMD_ALIGN_AMOUNT);
+            block.spectrum = gps_app.CreateSpectrum();
+        }
     }
     ~App() {
-        is_running = false;
-        if (runner_thread) {
-            runner_thread->join();
+        input_ring.Close();
+        pipeline.Stop();
+        if (reader_thread) {
+            reader_thread->join();
         }
     }
     void Start() {
-        if (is_running) return;
-        is_running = true;
-        runner_thread = std::make_unique<std::thread>([this]() {
-            RunnerThread();
+        if (pipeline.GetTotalStages() > 0) return;
+        reader_thread = std::make_unique<std::thread>([this]() {
+            ReaderThread();
+        });
+        pipeline.AddStage("source", 1, [this](const size_t i) { return ReadBlock(blocks[i]); });
+        pipeline.AddStage("convert", total_convert_threads, [this](const size_t i) { return ConvertBlock(blocks[i]); });
+        pipeline.AddStage("fft", 1, [this](const size_t i) {
+            auto& block = blocks[i];
+            gps_app.TransformBlock(block.samples, block.spectrum);
+            return true;
+        });
+        pipeline.AddStage("correlate", 1, [this](const size_t i) {
+            auto& block = blocks[i];
+            gps_app.CorrelateBlock(block.samples, block.spectrum);
+            return true;
         });
+        pipeline.Start();
     }
 public:
     auto& GetExtraGain() { return extra_gain; }
+    auto& GetIsRemoveDC() { return is_remove_dc; }
     auto& GetGPSApp() { return gps_app; }
+    auto& GetPipeline() { return pipeline; }
+    auto GetInputStats() const { return input_ring.GetStats(); }
 private:
-    void RunnerThread() {
-        while (is_running) {
-            const int N = gps_app.GetBlockSize();
-            const size_t nb_read = fread(buf_rd_raw_in.data(), sizeof(std::complex<uint8_t>), N, fp_in);
-            if (nb_read != (size_t)N) {
-                fprintf(stderr, "Failed to read in data %zu/%zu\n", nb_read, (size_t)N);
+    // read straight into the ring buffer a block at a time
+    void ReaderThread() {
+        const size_t N = (size_t)gps_app.GetBlockSize();
+        while (input_ring.WaitForWrite(1)) {
+            auto buf = input_ring.ReserveWrite(N);
+            const size_t nb_read = fread(buf.data(), sizeof(std::complex<uint8_t>), buf.size(), fp_in);
+            input_ring.CommitWrite(nb_read);
+            if (nb_read != buf.size()) {
                 break;
             }
+        }
+        input_ring.Close();
+    }
 
-            // type conversion 
-            {
-                const size_t M = N*2;
-                auto y = tcb::span(reinterpret_cast<float*>(&buf_rd_float_in[0]), M);
-                if (is_u8) {
-                    auto x = tcb::span(reinterpret_cast<uint8_t*>(&buf_rd_raw_in[0]), M);
-                    convert_uint8_to_float(x, y, extra_gain);
-                } else {
-                    auto x = tcb::span(reinterpret_cast<int8_t*>(&buf_rd_raw_in[0]), M);
-                    convert_int8_to_float(x, y, extra_gain);
-                }
-            }
-
-            gps_app.Process(buf_rd_float_in);
+    bool ReadBlock(Block& block) {
+        const size_t N = (size_t)gps_app.GetBlockSize();
+        const size_t nb_read = input_ring.Read(tcb::span(block.raw.data(), N));
+        if (nb_read != N) {
+            fprintf(stderr, "Failed to read in data %zu/%zu\n", nb_read, N);
+            return false;
         }
+        return true;
+    }
 
-        is_running = false;
+    // type conversion with offset, gain and dc removal in a single pass
+    bool ConvertBlock(Block& block) {
+        const int N = gps_app.GetBlockSize();
+        std::complex<float> curr_dc_offset = 0.0f;
+        if (is_remove_dc) {
+            auto lock = std::scoped_lock(mutex_dc_offset);
+            curr_dc_offset = dc_offset;
+        }
+        const float bias = is_u8 ? U8_IQ_BIAS : S8_IQ_BIAS;
+        const float scale = (is_u8 ? U8_IQ_SCALE : S8_IQ_SCALE) * extra_gain;
+        const auto offset = std::complex<float>(bias, bias) + curr_dc_offset;
+        std::complex<float> residual;
+        if (is_u8) {
+            auto* x = block.raw.data();
+            residual = cu8_to_c32_vec_convert_auto(x, block.samples.data(), N, offset, scale);
+        } else {
+            auto* x = reinterpret_cast<const std::complex<int8_t>*>(block.raw.data());
+            residual = cs8_to_c32_vec_convert_auto(x, block.samples.data(), N, offset, scale);
+        }
+        {
+            auto lock = std::scoped_lock(mutex_dc_offset);
+            if (is_remove_dc) {
+                dc_offset += DC_REMOVAL_BETA * residual / (float)N;
+            } else {
+                dc_offset = 0.0f;
+            }
+        }
+        return true;
     }
 };
 
@@ -156,6 +217,21 @@ public:
 
         if (ImGui::Begin("GPS")) {
             ImGui::Text("Total blocks = %d", gps_app.GetTotalBlocksRead());
+            if (ImGui::TreeNode("Pipeline")) {
+                auto& pipeline = app.GetPipeline();
+                const size_t total_stages = pipeline.GetTotalStages();
+                for (size_t i = 0; i < total_stages; i++) {
+                    const auto stats = pipeline.GetStageStats(i);
+                    ImGui::Text("%-10s threads=%zu time=%.0fus queued=%zu", 
+                        stats.name, stats.total_threads, stats.average_busy_us, stats.total_queued);
+                }
+                const auto input_stats = app.GetInputStats();
+                const float input_fill = 100.0f * (float)input_stats.fill / (float)input_stats.capacity;
+                const float input_max_fill = 100.0f * (float)input_stats.max_fill / (float)input_stats.capacity;
+                ImGui::Text("%-10s fill=%.0f%% max=%.0f%% stalls=%llu", 
+                    "input", input_fill, input_max_fill, (unsigned long long)input_stats.total_write_stalls);
+                ImGui::TreePop();
+            }
             ImGui::SliderFloat(
                 "Extra Gain", 
                 &app.GetExtraGain(), 
@@ -163,7 +239,20 @@ public:
                 ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_ClampOnInput);
             static bool is_show_peak_line = false;
             static int selected_freq_index = 0;
+            ImGui::Checkbox("Is remove DC", &app.GetIsRemoveDC());
             ImGui::Checkbox("Is always correlate", &gps_app.GetIsAlwaysCorrelate());
+            ImGui::Checkbox("Is tracking", &gps_app.GetIsTracking());
+            ImGui::Checkbox("Is two stage search", &gps_app.GetIsTwoStageSearch());
+            ImGui::SliderInt(
+                "Coherent blocks",
+                &gps_app.GetCoherentFoldCount(),
+                1, 20, "%d",
+                ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_ClampOnInput);
+            ImGui::SliderInt(
+                "Non-coherent blocks",
+                &gps_app.GetNonCoherentCount(),
+                1, 100, "%d",
+                ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_ClampOnInput);
             ImGui::Checkbox("Is show peak line", &is_show_peak_line);
 
             enum DisplayMode {
@@ -197,11 +286,13 @@ public:
             if (ImGui::BeginTabBar("Correlators")) {
                 auto& correlators = gps_app.GetCorrelators();
                 auto& trigger_flags = gps_app.GetCorrelatorTriggerFlags();
+                auto& trackers = gps_app.GetTrackers();
                 const int total_correlators = (int)correlators.size();
                 for (int i = 0; i < total_correlators; i++) {
                     const int prn_id = i+1;
-                    auto& correlator = correlators[i];
+                    auto& correlator = *correlators[i];
                     auto& trigger_flag = trigger_flags[i];
+                    auto& tracker = trackers[i];
 
                     ImGui::PushID(prn_id);
                     auto tab_label = fmt::format("{}", prn_id);
@@ -233,17 +324,23 @@ public:
 
                         const float freq_offset = freq_offsets[freq_index];
                         auto& x_corr = correlations[freq_index];
+                        const auto peak = correlator.GetCorrelationPeaks()[freq_index];
+                        const float peak_ratio = (peak.second_value > 0.0f) ? (peak.value / peak.second_value) : 0.0f;
                         ImGui::Text("Frequency offset= %.1fkHz", freq_offset * 1e-3f);
+                        ImGui::Text("Peak to second peak= %.2f", peak_ratio);
+                        if (tracker.GetIsLocked()) {
+                            ImGui::Text("Tracking: code phase= %.1f, frequency= %.1fHz, lock ratio= %.1f", 
+                                tracker.GetCodePhase(), tracker.GetCarrierFrequency(), tracker.GetLockRatio());
+                        } else {
+                            ImGui::Text("Tracking: not locked");
+                        }
                         if (ImPlot::BeginPlot("Correlation Peak")) {
                             ImPlot::SetupAxisLimits(ImAxis_Y1, 0.0f, 100.0f, ImPlotCond_Once);
                             ImPlot::PlotLine("Magnitude", x_corr.data(), (int)x_corr.size());
 
                             if (is_show_peak_line) {
-                                int peak_index = 0; 
-                                float peak_value = 0.0f;
-                                GetCorrelationPeakIndex(x_corr, peak_index, peak_value);
-                                double marker_0 = (double)peak_index;
-                                double marker_1 = (double)peak_value;
+                                double marker_0 = (double)peak.index;
+                                double marker_1 = (double)peak.value;
                                 int marker_id = 0;
                                 ImPlot::DragLineX(marker_id++, &marker_0, ImVec4(1,0,0,1), 1.0f, ImPlotDragToolFlags_NoInputs);
                                 ImPlot::DragLineY(marker_id++, &marker_1, ImVec4(1,0,0,1), 1.0f, ImPlotDragToolFlags_NoInputs);
@@ -264,22 +361,6 @@ public:
     virtual void AfterShutdown() {
         ImPlot::DestroyContext();
     }
-private:
-    void GetCorrelationPeakIndex(tcb::span<const float> x, int& index, float& value) {
-        int peak_index = 0;
-        float peak_value = x[0];
-        const size_t N = x.size();
-        for (size_t i = 0; i < N; i++) {
-            const float v = x[i];
-            if (v > peak_value) {
-                peak_value = v;
-                peak_index = (int)i;
-            }
-        }
-
-        index = peak_index;
-        value = peak_value;
-    }
 };
 
 
@@ -291,7 +372,21 @@ void usage() {
         "\t[-f sample rate (default: 2048000Hz)]\n"
         "\t[-F IQ format (default: u8) (options: u8, s8)]\n"
         "\t[-g extra gain (default: 1)]\n"
+        "\t[-c coherently folded blocks before fft (default: 1)]\n"
+        "\t[-n non-coherent integration blocks (default: 1)]\n"
         "\t[-A (Always run correlation on each PRN)]\n"
+        "\t[-T (Track acquired PRNs with time domain correlators)]\n"
+        "\t[-P fft planning effort (default: estimate) (options: estimate, measure, patient, exhaustive)]\n"
+        "\t[-w fft wisdom filename (default: None)]\n"
+        "\t    Measured plans are loaded from and saved to this file\n"
+        "\t[-B fft backend (default: auto) (options: auto, fftw, portable, avx2)]\n"
+        "\t    Auto benchmarks the available backends at startup and picks the fastest\n"
+        "\t[-j sample conversion threads (default: 1)]\n"
+        "\t[-t correlation threads (default: hardware concurrency)]\n"
+        "\t[-b blocks in flight between pipeline stages (default: 4)]\n"
+        "\t[-r input buffer size in blocks (default: 256)]\n"
+        "\t[-s time idle correlation threads spin before sleeping in microseconds (default: 100)]\n"
+        "\t    Longer spins lower the dispatch latency of each block but keep a core busy for every thread\n"
         "\t[-h (show usage)]\n"
     );
 }
@@ -301,10 +396,22 @@ int main(int argc, char** argv) {
     float extra_gain = 1.0f;
     bool is_u8 = true;
     bool is_always_correlate = false;
+    bool is_tracking = false;
+    int coherent_fold_count = 1;
+    int noncoherent_count = 1;
     int Fs = 2'048'000;
+    auto fft_plan_effort = FFT_PlanEffort::ESTIMATE;
+    char* wisdom_filename = NULL;
+    auto fft_backend = FFT_Backend::AUTO;
+    int total_convert_threads = 1;
+    // 0 uses every hardware thread
+    int total_correlate_threads = 0;
+    int total_blocks_in_flight = 4;
+    int total_input_blocks = 256;
+    int spin_duration_us = (int)WorkStealingPool::DEFAULT_SPIN_DURATION_US;
 
     int opt; 
-    while ((opt = getopt_custom(argc, argv, "i:f:F:g:Ah")) != -1) {
+    while ((opt = getopt_custom(argc, argv, "i:f:F:g:c:n:ATP:w:B:j:t:b:r:s:h")) != -1) {
         switch (opt) {
         case 'i':
             rd_filename = optarg;
@@ -322,9 +429,64 @@ int main(int argc, char** argv) {
         case 'g':
             extra_gain = (float)atof(optarg);
             break;
+        case 'c':
+            coherent_fold_count = (int)atof(optarg);
+            break;
+        case 'n':
+            noncoherent_count = (int)atof(optarg);
+            break;
         case 'A':
             is_always_correlate = true;
             break;
+        case 'T':
+            is_tracking = true;
+            break;
+        case 'P':
+            if (strncmp("estimate", optarg, 9) == 0) {
+                fft_plan_effort = FFT_PlanEffort::ESTIMATE;
+            } else if (strncmp("measure", optarg, 8) == 0) {
+                fft_plan_effort = FFT_PlanEffort::MEASURE;
+            } else if (strncmp("patient", optarg, 8) == 0) {
+                fft_plan_effort = FFT_PlanEffort::PATIENT;
+            } else if (strncmp("exhaustive", optarg, 11) == 0) {
+                fft_plan_effort = FFT_PlanEffort::EXHAUSTIVE;
+            } else {
+                fprintf(stderr, "Got invalid fft planning effort '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            wisdom_filename = optarg;
+            break;
+        case 'B':
+            if (strncmp("auto", optarg, 5) == 0) {
+                fft_backend = FFT_Backend::AUTO;
+            } else if (strncmp("fftw", optarg, 5) == 0) {
+                fft_backend = FFT_Backend::FFTW;
+            } else if (strncmp("portable", optarg, 9) == 0) {
+                fft_backend = FFT_Backend::PORTABLE;
+            } else if (strncmp("avx2", optarg, 5) == 0) {
+                fft_backend = FFT_Backend::AVX2;
+            } else {
+                fprintf(stderr, "Got invalid fft backend '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'j':
+            total_convert_threads = (int)atof(optarg);
+            break;
+        case 't':
+            total_correlate_threads = (int)atof(optarg);
+            break;
+        case 'b':
+            total_blocks_in_flight = (int)atof(optarg);
+            break;
+        case 'r':
+            total_input_blocks = (int)atof(optarg);
+            break;
+        case 's':
+            spin_duration_us = (int)atof(optarg);
+            break;
         case 'h':
         default:
             usage();
@@ -337,6 +499,41 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (coherent_fold_count <= 0) {
+        fprintf(stderr, "Got invalid coherently folded blocks %d <= 0\n", coherent_fold_count);
+        return 1;
+    }
+
+    if (noncoherent_count <= 0) {
+        fprintf(stderr, "Got invalid non-coherent integration blocks %d <= 0\n", noncoherent_count);
+        return 1;
+    }
+
+    if (total_convert_threads <= 0) {
+        fprintf(stderr, "Got invalid sample conversion threads %d <= 0\n", total_convert_threads);
+        return 1;
+    }
+
+    if (total_correlate_threads < 0) {
+        fprintf(stderr, "Got invalid correlation threads %d < 0\n", total_correlate_threads);
+        return 1;
+    }
+
+    if (total_blocks_in_flight <= 0) {
+        fprintf(stderr, "Got invalid blocks in flight %d <= 0\n", total_blocks_in_flight);
+        return 1;
+    }
+
+    if (total_input_blocks <= 0) {
+        fprintf(stderr, "Got invalid input buffer size %d <= 0\n", total_input_blocks);
+        return 1;
+    }
+
+    if (spin_duration_us < 0) {
+        fprintf(stderr, "Got invalid spin time %d < 0\n", spin_duration_us);
+        return 1;
+    }
+
     if ((Fs % GPS_FIXED_PARAMS.Fcode) != 0) {
         fprintf(stderr, "WARNING: Got sample rate %d which is not a multiple of PRN code rate %d\n", 
             Fs, GPS_FIXED_PARAMS.Fcode);
@@ -356,13 +553,38 @@ int main(int argc, char** argv) {
     _setmode(_fileno(fp_in), _O_BINARY);
 #endif
 
-    auto app = App(fp_in, Fs, is_u8);
+    // NOTE: Plans are created when the app is constructed so wisdom has to be loaded first
+    if (!SetFFTBackend(fft_backend)) {
+        fprintf(stderr, "fft backend '%s' is not available in this build\n", GetFFTBackendName(fft_backend));
+        return 1;
+    }
+    SetFFTPlanEffort(fft_plan_effort);
+    if (wisdom_filename != NULL) {
+        if (!LoadFFTWisdom(wisdom_filename)) {
+            fprintf(stderr, "No fft wisdom loaded from '%s'\n", wisdom_filename);
+        }
+    }
+
+    auto app = App(fp_in, Fs, is_u8, 
+        (size_t)total_convert_threads, (size_t)total_correlate_threads, (size_t)total_blocks_in_flight, (size_t)total_input_blocks);
     auto& gps_app = app.GetGPSApp();
+    fprintf(stderr, "Using simd kernels for '%s'\n", dsp_get_simd_level_name(dsp_get_simd_level()));
+    fprintf(stderr, "Using fft backend '%s' for block size %d\n", 
+        GetFFTBackendName(GetFFTBackend((size_t)gps_app.GetBlockSize())), gps_app.GetBlockSize());
     app.GetExtraGain() = extra_gain;
     gps_app.GetIsAlwaysCorrelate() = is_always_correlate;
+    gps_app.GetIsTracking() = is_tracking;
+    gps_app.GetCoherentFoldCount() = coherent_fold_count;
+    gps_app.GetNonCoherentCount() = noncoherent_count;
+    gps_app.GetCorrelatorThreadPool().SetSpinDuration(std::chrono::microseconds(spin_duration_us));
 
     auto renderer = Renderer(app);
     app.Start();
     const int rv = RenderImguiSkeleton(&renderer);
+    if (wisdom_filename != NULL) {
+        if (!SaveFFTWisdom(wisdom_filename)) {
+            fprintf(stderr, "Failed to save fft wisdom to '%s'\n", wisdom_filename);
+        }
+    }
     return rv; 
 }
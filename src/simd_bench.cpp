@@ -0,0 +1,843 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <initializer_list>
+#include <type_traits>
+
+#include "dsp/simd/cpu_features.h"
+#include "dsp/simd/c32_vec_mul.h"
+#include "dsp/simd/c32_f32_vec_dot.h"
+#include "dsp/simd/c32_vec_mag_accumulate.h"
+#include "dsp/simd/c32_vec_mag_peak.h"
+#include "dsp/simd/c32_vec_oscillator.h"
+#include "dsp/simd/iq8_vec_convert.h"
+#include "utility/aligned_vector.h"
+#include "utility/getopt/getopt.h"
+
+void usage() {
+    fprintf(stderr,
+        "simd_bench, Checks every dsp simd kernel variant against a reference and benchmarks them\n\n"
+        "\t[-m mode (default: all)]\n"
+        "\t    all: Run conformance checks then benchmarks\n"
+        "\t    check: Only run conformance checks\n"
+        "\t    bench: Only run benchmarks\n"
+        "\t[-t total random sizes to check (default: 500)]\n"
+        "\t[-s random seed (default: 0)]\n"
+        "\t[-b benchmark block size (default: 2048)]\n"
+        "\t[-r benchmark runs per measurement (default: 10000)]\n"
+        "\t[-h (show usage)]\n"
+    );
+}
+
+// Sizes 0 to MAX_SMALL_SIZE are all checked to cover every tail length
+constexpr int MAX_SMALL_SIZE = 64;
+constexpr int MAX_RANDOM_SIZE = 4096;
+// Buffers are offset by up to this many elements from a 64 byte boundary
+constexpr int MAX_MISALIGN = 15;
+// Outputs are followed by guard bytes that kernels must not write to
+constexpr int TOTAL_GUARD_BYTES = 128;
+constexpr uint8_t GUARD_BYTE = 0xCD;
+constexpr int TOTAL_BENCH_MEASUREMENTS = 5;
+// Kernels specialised on a size are checked this many times with random data and alignment
+constexpr int TOTAL_FIXED_SIZE_RUNS = 16;
+
+using cf = std::complex<float>;
+using rng_t = std::mt19937;
+
+template <typename F>
+struct Kernel {
+    const char* name;
+    DSP_SIMD_Level level;
+    F func;
+};
+
+// Only keep the variants that are compiled in and supported by this cpu
+template <typename F>
+static std::vector<Kernel<F>> GetAvailableKernels(std::initializer_list<Kernel<F>> kernels) {
+    std::vector<Kernel<F>> available;
+    for (const auto& kernel: kernels) {
+        if (kernel.level <= dsp_get_simd_level()) {
+            available.push_back(kernel);
+        }
+    }
+    return available;
+}
+
+#define KERNEL(func, variant, level) { #variant, DSP_SIMD_Level::level, &func##_##variant }
+#if defined(_DSP_SSSE3)
+#define KERNEL_SSSE3(func) KERNEL(func, ssse3, SSSE3),
+#else
+#define KERNEL_SSSE3(func)
+#endif
+#if defined(_DSP_AVX2)
+#define KERNEL_AVX2(func) KERNEL(func, avx2, AVX2),
+#else
+#define KERNEL_AVX2(func)
+#endif
+#if defined(_DSP_AVX512)
+#define KERNEL_AVX512(func) KERNEL(func, avx512, AVX512),
+#else
+#define KERNEL_AVX512(func)
+#endif
+#define GET_KERNELS(func) GetAvailableKernels<decltype(&func##_scalar)>({\
+    KERNEL(func, scalar, SCALAR), KERNEL_SSSE3(func) KERNEL_AVX2(func) })
+#define GET_KERNELS_WITH_AVX512(func) GetAvailableKernels<decltype(&func##_scalar)>({\
+    KERNEL(func, scalar, SCALAR), KERNEL_SSSE3(func) KERNEL_AVX2(func) KERNEL_AVX512(func) })
+// Functions built on top of the dispatched kernels only have an auto variant
+#define GET_AUTO_KERNEL(func) GetAvailableKernels<decltype(&func)>({ { "auto", DSP_SIMD_Level::SCALAR, &func } })
+// Kernels specialised on a compile time size which the correlators use with and without runtime dispatch
+#define KERNEL_FIXED(func, variant, level, N) { #variant, DSP_SIMD_Level::level, &func##_##variant<N> }
+#if defined(_DSP_SSSE3)
+#define KERNEL_FIXED_SSSE3(func, N) KERNEL_FIXED(func, ssse3, SSSE3, N),
+#else
+#define KERNEL_FIXED_SSSE3(func, N)
+#endif
+#if defined(_DSP_AVX2)
+#define KERNEL_FIXED_AVX2(func, N) KERNEL_FIXED(func, avx2, AVX2, N),
+#else
+#define KERNEL_FIXED_AVX2(func, N)
+#endif
+#if defined(_DSP_AVX512)
+#define KERNEL_FIXED_AVX512(func, N) KERNEL_FIXED(func, avx512, AVX512, N),
+#else
+#define KERNEL_FIXED_AVX512(func, N)
+#endif
+#define GET_FIXED_KERNELS_WITH_AVX512(func, N) GetAvailableKernels<decltype(&func##_scalar)>({\
+    KERNEL_FIXED_SSSE3(func, N) KERNEL_FIXED_AVX2(func, N) KERNEL_FIXED_AVX512(func, N) KERNEL_FIXED(func, auto, SCALAR, N) })
+
+// Misaligned view into an aligned buffer with guard bytes after the last element
+template <typename T>
+class TestBuffer
+{
+private:
+    AlignedVector<uint8_t> buf;
+    T* data;
+    int N;
+public:
+    TestBuffer(const int _N, const int misalign)
+    : buf((_N+MAX_MISALIGN)*sizeof(T) + TOTAL_GUARD_BYTES, 64), N(_N)
+    {
+        data = reinterpret_cast<T*>(buf.data() + misalign*sizeof(T));
+        memset(buf.data(), GUARD_BYTE, buf.size());
+    }
+    T* get() { return data; }
+    T& operator[](const int i) { return data[i]; }
+    bool GetIsGuardIntact() const {
+        const auto* guard = reinterpret_cast<const uint8_t*>(&data[N]);
+        for (int i = 0; i < TOTAL_GUARD_BYTES; i++) {
+            if (guard[i] != GUARD_BYTE) return false;
+        }
+        return true;
+    }
+};
+
+static bool GetIsClose(const double x, const double y, const double tolerance) {
+    const double scale = std::max({ 1.0, std::abs(x), std::abs(y) });
+    return std::abs(x-y) <= tolerance*scale;
+}
+
+static bool GetIsClose(const cf x, const std::complex<double> y, const double tolerance) {
+    const double scale = std::max({ 1.0, std::abs(std::complex<double>(x)), std::abs(y) });
+    return std::abs(std::complex<double>(x)-y) <= tolerance*scale;
+}
+
+struct Context {
+    rng_t rng;
+    int total_random_sizes;
+    int bench_size;
+    int bench_runs;
+    int total_failures = 0;
+};
+
+// Calls check(kernel, N, misalign) over every small size and random sizes
+template <typename F, typename G>
+static void RunCheck(Context& ctx, const char* name, const std::vector<Kernel<F>>& kernels, G&& check) {
+    auto misalign_dist = std::uniform_int_distribution<int>(0, MAX_MISALIGN);
+    auto size_dist = std::uniform_int_distribution<int>(0, MAX_RANDOM_SIZE);
+    const int total_sizes = MAX_SMALL_SIZE+1+ctx.total_random_sizes;
+    for (const auto& kernel: kernels) {
+        int total_failures = 0;
+        int first_failed_size = -1;
+        for (int i = 0; i < total_sizes; i++) {
+            const int N = (i <= MAX_SMALL_SIZE) ? i : size_dist(ctx.rng);
+            const int misalign = misalign_dist(ctx.rng);
+            if (!check(kernel.func, N, misalign)) {
+                if (total_failures == 0) first_failed_size = N;
+                total_failures++;
+            }
+        }
+        if (total_failures == 0) {
+            fprintf(stderr, "[check] %-24s %-8s ok (%d sizes)\n", name, kernel.name, total_sizes);
+        } else {
+            fprintf(stderr, "[check] %-24s %-8s FAILED %d/%d sizes (first at N=%d)\n",
+                name, kernel.name, total_failures, total_sizes, first_failed_size);
+        }
+        ctx.total_failures += total_failures;
+    }
+}
+
+// Calls check(kernel, N_FIXED, misalign) for kernels that are specialised on the size N_FIXED
+template <typename F, typename G>
+static void RunFixedCheck(Context& ctx, const char* name, const int N_FIXED, const std::vector<Kernel<F>>& kernels, G&& check) {
+    auto misalign_dist = std::uniform_int_distribution<int>(0, MAX_MISALIGN);
+    char fixed_name[64];
+    snprintf(fixed_name, sizeof(fixed_name), "%s<%d>", name, N_FIXED);
+    for (const auto& kernel: kernels) {
+        int total_failures = 0;
+        for (int i = 0; i < TOTAL_FIXED_SIZE_RUNS; i++) {
+            if (!check(kernel.func, N_FIXED, misalign_dist(ctx.rng))) {
+                total_failures++;
+            }
+        }
+        if (total_failures == 0) {
+            fprintf(stderr, "[check] %-24s %-8s ok (%d runs)\n", fixed_name, kernel.name, TOTAL_FIXED_SIZE_RUNS);
+        } else {
+            fprintf(stderr, "[check] %-24s %-8s FAILED %d/%d runs\n", fixed_name, kernel.name, total_failures, TOTAL_FIXED_SIZE_RUNS);
+        }
+        ctx.total_failures += total_failures;
+    }
+}
+
+// Calls func(std::integral_constant<int, N>) for each size N so kernels can be instantiated on it
+// The correlators specialise on blocks of 2048, 4096 and 8192 samples, the halves and quarters of those
+// for the coarse search and the tiles of the multiply
+template <int... N_FIXED, typename F>
+static void ForEachFixedSize(F&& func) {
+    (func(std::integral_constant<int, N_FIXED>{}), ...);
+}
+
+// Best of several measurements to reduce scheduling noise
+template <typename G>
+static double MeasureNanoseconds(const int total_runs, G&& run) {
+    double best_ns = INFINITY;
+    for (int i = 0; i < TOTAL_BENCH_MEASUREMENTS; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < total_runs; j++) {
+            run();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const double ns = std::chrono::duration<double, std::nano>(end-start).count();
+        best_ns = std::min(best_ns, ns / double(total_runs));
+    }
+    return best_ns;
+}
+
+// bytes_per_element is the memory read and written per element for the bandwidth figure
+template <typename F, typename G>
+static void RunBench(Context& ctx, const char* name, const std::vector<Kernel<F>>& kernels, const int bytes_per_element, G&& bench) {
+    const int N = ctx.bench_size;
+    for (const auto& kernel: kernels) {
+        const double ns = MeasureNanoseconds(ctx.bench_runs, [&]() { bench(kernel.func, N); });
+        const double ns_per_element = ns / double(N);
+        const double gb_per_second = double(bytes_per_element)*double(N) / ns;
+        fprintf(stderr, "[bench] %-24s %-8s %9.1f ns %7.3f ns/elem %7.2f GB/s\n",
+            name, kernel.name, ns, ns_per_element, gb_per_second);
+    }
+}
+
+static void FillRandom(rng_t& rng, cf* x, const int N) {
+    auto dist = std::normal_distribution<float>(0.0f, 1.0f);
+    for (int i = 0; i < N; i++) x[i] = cf(dist(rng), dist(rng));
+}
+
+static void FillRandom(rng_t& rng, float* x, const int N) {
+    auto dist = std::normal_distribution<float>(0.0f, 1.0f);
+    for (int i = 0; i < N; i++) x[i] = dist(rng);
+}
+
+template <typename T>
+static void FillRandomBytes(rng_t& rng, T* x, const int N) {
+    auto dist = std::uniform_int_distribution<int>(0, 255);
+    auto* y = reinterpret_cast<uint8_t*>(x);
+    for (size_t i = 0; i < size_t(N)*sizeof(T); i++) y[i] = uint8_t(dist(rng));
+}
+
+static void TestVecMul(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mul";
+    const auto kernels = GET_KERNELS_WITH_AVX512(c32_vec_mul);
+    if (is_check) {
+        const auto check = [&](auto func, const int N, const int misalign) {
+            auto x0 = TestBuffer<cf>(N, misalign);
+            auto x1 = TestBuffer<cf>(N, MAX_MISALIGN-misalign);
+            auto y = TestBuffer<cf>(N, misalign/2);
+            FillRandom(ctx.rng, x0.get(), N);
+            FillRandom(ctx.rng, x1.get(), N);
+            func(x0.get(), x1.get(), y.get(), N);
+            bool is_pass = y.GetIsGuardIntact();
+            for (int i = 0; i < N; i++) {
+                const auto ref = std::complex<double>(x0[i]) * std::complex<double>(x1[i]);
+                is_pass = is_pass && GetIsClose(y[i], ref, 1e-5);
+            }
+            return is_pass;
+        };
+        RunCheck(ctx, name, kernels, check);
+        ForEachFixedSize<C32_VEC_MUL_TILE_SIZE>([&](auto size) {
+            constexpr int N_FIXED = decltype(size)::value;
+            RunFixedCheck(ctx, name, N_FIXED, GET_FIXED_KERNELS_WITH_AVX512(c32_vec_mul, N_FIXED), check);
+        });
+    }
+    if (is_bench) {
+        auto x0 = AlignedVector<cf>(ctx.bench_size);
+        auto x1 = AlignedVector<cf>(ctx.bench_size);
+        auto y = AlignedVector<cf>(ctx.bench_size);
+        FillRandom(ctx.rng, x0.data(), ctx.bench_size);
+        FillRandom(ctx.rng, x1.data(), ctx.bench_size);
+        RunBench(ctx, name, kernels, 3*sizeof(cf), [&](auto func, const int N) {
+            func(x0.data(), x1.data(), y.data(), N);
+        });
+    }
+}
+
+static void TestVecMulTiled(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mul_tiled";
+    const auto kernels = GET_AUTO_KERNEL(c32_vec_mul_tiled_auto<>);
+    constexpr int MAX_TASKS = 8;
+    if (is_check) {
+        auto task_dist = std::uniform_int_distribution<int>(1, MAX_TASKS);
+        const auto check = [&](auto func, const int N, const int misalign) {
+            // Every task multiplies a rotation of the same doubled operand like the input bank
+            auto x0 = AlignedVector<cf>(2*N+MAX_MISALIGN+1, 64);
+            auto* x0_data = x0.data()+misalign;
+            FillRandom(ctx.rng, x0_data, N);
+            std::copy_n(x0_data, N, x0_data+N);
+            const int total_tasks = task_dist(ctx.rng);
+            // Fixed sizes only have fixed size tiles with the default tile size
+            const bool is_default_tile = std::uniform_int_distribution<int>(0, 1)(ctx.rng) == 0;
+            const int tile_size = is_default_tile ? C32_VEC_MUL_TILE_SIZE : std::uniform_int_distribution<int>(1, N+1)(ctx.rng);
+            std::vector<TestBuffer<cf>> x1;
+            std::vector<TestBuffer<cf>> y;
+            std::vector<c32_vec_mul_task_t> tasks;
+            std::vector<int> rotations;
+            // Some tasks also read x1 from a single copy starting at a rotation and wrapping back to its start
+            std::vector<int> x1_rotations;
+            for (int i = 0; i < total_tasks; i++) {
+                x1.emplace_back(N, (misalign+i) % (MAX_MISALIGN+1));
+                y.emplace_back(N, (misalign+2*i) % (MAX_MISALIGN+1));
+                FillRandom(ctx.rng, x1[i].get(), N);
+                rotations.push_back((N > 0) ? std::uniform_int_distribution<int>(0, N-1)(ctx.rng) : 0);
+                const bool is_wrap = std::uniform_int_distribution<int>(0, 1)(ctx.rng) == 0;
+                x1_rotations.push_back((is_wrap && N > 0) ? std::uniform_int_distribution<int>(0, N-1)(ctx.rng) : -1);
+            }
+            for (int i = 0; i < total_tasks; i++) {
+                const int r = x1_rotations[i];
+                if (r < 0) {
+                    tasks.push_back({ x0_data+rotations[i], x1[i].get(), y[i].get() });
+                } else {
+                    tasks.push_back({ x0_data+rotations[i], x1[i].get()+r, y[i].get(), x1[i].get(), N-r });
+                }
+            }
+            func(tasks.data(), total_tasks, N, tile_size);
+            bool is_pass = true;
+            for (int j = 0; j < total_tasks; j++) {
+                is_pass = is_pass && y[j].GetIsGuardIntact();
+                const int r = std::max(x1_rotations[j], 0);
+                for (int i = 0; i < N; i++) {
+                    const auto ref = std::complex<double>(x0_data[rotations[j]+i]) * std::complex<double>(x1[j][(r+i) % N]);
+                    is_pass = is_pass && GetIsClose(y[j][i], ref, 1e-5);
+                }
+            }
+            return is_pass;
+        };
+        RunCheck(ctx, name, kernels, check);
+        ForEachFixedSize<512, 1024, 2048, 4096, 8192>([&](auto size) {
+            constexpr int N_FIXED = decltype(size)::value;
+            RunFixedCheck(ctx, name, N_FIXED, GET_AUTO_KERNEL(c32_vec_mul_tiled_auto<N_FIXED>), check);
+        });
+    }
+    if (is_bench) {
+        const int N = ctx.bench_size;
+        auto x0 = AlignedVector<cf>(2*N);
+        auto x1 = AlignedVector<cf>(MAX_TASKS*N);
+        auto y = AlignedVector<cf>(MAX_TASKS*N);
+        FillRandom(ctx.rng, x0.data(), 2*N);
+        FillRandom(ctx.rng, x1.data(), MAX_TASKS*N);
+        std::vector<c32_vec_mul_task_t> tasks;
+        for (int i = 0; i < MAX_TASKS; i++) {
+            tasks.push_back({ &x0[i], &x1[i*N], &y[i*N] });
+        }
+        RunBench(ctx, name, kernels, MAX_TASKS*3*sizeof(cf), [&](auto func, const int N) {
+            func(tasks.data(), MAX_TASKS, N, C32_VEC_MUL_TILE_SIZE);
+        });
+    }
+}
+
+static void TestVecDot(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_f32_vec_dot";
+    const auto kernels = GET_KERNELS(c32_f32_vec_dot);
+    if (is_check) {
+        RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+            auto x0 = TestBuffer<cf>(N, misalign);
+            auto x1 = TestBuffer<float>(N, MAX_MISALIGN-misalign);
+            FillRandom(ctx.rng, x0.get(), N);
+            FillRandom(ctx.rng, x1.get(), N);
+            const cf y = func(x0.get(), x1.get(), N);
+            // Summation order differs between variants so compare relative to the sum of magnitudes
+            std::complex<double> ref = 0.0;
+            double ref_magnitude = 0.0;
+            for (int i = 0; i < N; i++) {
+                ref += std::complex<double>(x0[i]) * double(x1[i]);
+                ref_magnitude += std::abs(std::complex<double>(x0[i]) * double(x1[i]));
+            }
+            return std::abs(std::complex<double>(y)-ref) <= 1e-5*std::max(1.0, ref_magnitude);
+        });
+    }
+    if (is_bench) {
+        auto x0 = AlignedVector<cf>(ctx.bench_size);
+        auto x1 = AlignedVector<float>(ctx.bench_size);
+        FillRandom(ctx.rng, x0.data(), ctx.bench_size);
+        FillRandom(ctx.rng, x1.data(), ctx.bench_size);
+        volatile float sink = 0.0f;
+        RunBench(ctx, name, kernels, sizeof(cf)+sizeof(float), [&](auto func, const int N) {
+            sink = func(x0.data(), x1.data(), N).real();
+        });
+    }
+}
+
+static void TestVecMagAccumulate(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mag_accumulate";
+    const auto kernels = GET_KERNELS_WITH_AVX512(c32_vec_mag_accumulate);
+    constexpr float scale = 0.25f;
+    if (is_check) {
+        const auto check = [&](auto func, const int N, const int misalign) {
+            auto x = TestBuffer<cf>(N, misalign);
+            auto y = TestBuffer<float>(N, MAX_MISALIGN-misalign);
+            FillRandom(ctx.rng, x.get(), N);
+            FillRandom(ctx.rng, y.get(), N);
+            auto y_in = std::vector<float>(y.get(), y.get()+N);
+            func(x.get(), y.get(), N, scale);
+            bool is_pass = y.GetIsGuardIntact();
+            for (int i = 0; i < N; i++) {
+                const double ref = double(y_in[i]) + double(scale)*std::norm(std::complex<double>(x[i]));
+                is_pass = is_pass && GetIsClose(y[i], ref, 1e-5);
+            }
+            return is_pass;
+        };
+        RunCheck(ctx, name, kernels, check);
+        ForEachFixedSize<2048, 4096, 8192>([&](auto size) {
+            constexpr int N_FIXED = decltype(size)::value;
+            RunFixedCheck(ctx, name, N_FIXED, GET_FIXED_KERNELS_WITH_AVX512(c32_vec_mag_accumulate, N_FIXED), check);
+        });
+    }
+    if (is_bench) {
+        auto x = AlignedVector<cf>(ctx.bench_size);
+        auto y = AlignedVector<float>(ctx.bench_size);
+        FillRandom(ctx.rng, x.data(), ctx.bench_size);
+        FillRandom(ctx.rng, y.data(), ctx.bench_size);
+        RunBench(ctx, name, kernels, sizeof(cf)+2*sizeof(float), [&](auto func, const int N) {
+            func(x.data(), y.data(), N, 1e-9f);
+        });
+    }
+}
+
+static void TestVecArgmax(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "f32_vec_argmax";
+    const auto kernels = GET_KERNELS_WITH_AVX512(f32_vec_argmax);
+    constexpr int index_offset = 7;
+    if (is_check) {
+        const auto check = [&](auto func, const int N, const int misalign) {
+            auto x = TestBuffer<float>(N, misalign);
+            FillRandom(ctx.rng, x.get(), N);
+            // Add ties so the earliest index has to be picked
+            if (N > 2) x[N-1] = x[N/2];
+            int peak_index = -1;
+            float peak_value = -INFINITY;
+            func(x.get(), N, index_offset, peak_index, peak_value);
+            int ref_index = -1;
+            float ref_value = -INFINITY;
+            for (int i = 0; i < N; i++) {
+                if (x[i] > ref_value) {
+                    ref_value = x[i];
+                    ref_index = index_offset+i;
+                }
+            }
+            return (peak_index == ref_index) && (peak_value == ref_value);
+        };
+        RunCheck(ctx, name, kernels, check);
+        ForEachFixedSize<2048, 4096, 8192>([&](auto size) {
+            constexpr int N_FIXED = decltype(size)::value;
+            RunFixedCheck(ctx, name, N_FIXED, GET_FIXED_KERNELS_WITH_AVX512(f32_vec_argmax, N_FIXED), check);
+        });
+    }
+    if (is_bench) {
+        auto x = AlignedVector<float>(ctx.bench_size);
+        FillRandom(ctx.rng, x.data(), ctx.bench_size);
+        volatile int sink = 0;
+        RunBench(ctx, name, kernels, sizeof(float), [&](auto func, const int N) {
+            int peak_index = 0;
+            float peak_value = -INFINITY;
+            func(x.data(), N, 0, peak_index, peak_value);
+            sink = peak_index;
+        });
+    }
+}
+
+static void TestVecMagArgmax(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mag_argmax";
+    const auto kernels = GET_KERNELS_WITH_AVX512(c32_vec_mag_argmax);
+    constexpr int index_offset = 3;
+    constexpr float scale = 0.5f;
+    if (is_check) {
+        for (const bool is_squared: { false, true }) {
+            const char* check_name = is_squared ? "c32_vec_mag_argmax(sq)" : name;
+            const auto check = [&](auto func, const int N, const int misalign) {
+                auto x = TestBuffer<cf>(N, misalign);
+                auto y = TestBuffer<float>(N, MAX_MISALIGN-misalign);
+                FillRandom(ctx.rng, x.get(), N);
+                int peak_index = 0;
+                float peak_value = -1.0f;
+                float sum = 0.0f;
+                func(x.get(), y.get(), N, index_offset, scale, is_squared, peak_index, peak_value, sum);
+                bool is_pass = y.GetIsGuardIntact();
+                double ref_sum = 0.0;
+                double ref_value = -1.0;
+                for (int i = 0; i < N; i++) {
+                    double v = std::norm(std::complex<double>(x[i]));
+                    if (!is_squared) v = std::sqrt(v);
+                    v = v*double(scale);
+                    ref_sum += v;
+                    ref_value = std::max(ref_value, v);
+                    is_pass = is_pass && GetIsClose(y[i], v, 1e-5);
+                }
+                // Rounding can reorder near ties so only require the picked index to hold the peak value
+                is_pass = is_pass && GetIsClose(peak_value, ref_value, 1e-5);
+                if (N > 0) {
+                    const int i = peak_index-index_offset;
+                    is_pass = is_pass && (i >= 0) && (i < N) && GetIsClose(y[i], ref_value, 1e-5);
+                }
+                is_pass = is_pass && GetIsClose(sum, ref_sum, 1e-4);
+                return is_pass;
+            };
+            RunCheck(ctx, check_name, kernels, check);
+            ForEachFixedSize<1024, 2048, 4096, 8192>([&](auto size) {
+                constexpr int N_FIXED = decltype(size)::value;
+                RunFixedCheck(ctx, check_name, N_FIXED, GET_FIXED_KERNELS_WITH_AVX512(c32_vec_mag_argmax, N_FIXED), check);
+            });
+        }
+    }
+    if (is_bench) {
+        auto x = AlignedVector<cf>(ctx.bench_size);
+        auto y = AlignedVector<float>(ctx.bench_size);
+        FillRandom(ctx.rng, x.data(), ctx.bench_size);
+        volatile float sink = 0.0f;
+        RunBench(ctx, name, kernels, sizeof(cf)+sizeof(float), [&](auto func, const int N) {
+            int peak_index = 0;
+            float peak_value = -1.0f;
+            float sum = 0.0f;
+            func(x.data(), y.data(), N, 0, 1.0f, true, peak_index, peak_value, sum);
+            sink = sum;
+        });
+    }
+}
+
+// Second peak has to be the largest value whose circular distance from the peak is more than exclusion
+static bool GetIsSecondPeakCorrect(const float* x, const int N, const int exclusion, const vec_peak_t& peak) {
+    const int N_search = N - (2*exclusion+1);
+    if (N_search <= 0) {
+        return (peak.second_index == 0) && (peak.second_value == 0.0f);
+    }
+    float ref_value = -INFINITY;
+    for (int i = 0; i < N; i++) {
+        const int distance = std::abs(i-peak.index);
+        if (std::min(distance, N-distance) <= exclusion) continue;
+        ref_value = std::max(ref_value, x[i]);
+    }
+    const int i = peak.second_index;
+    const int distance = std::abs(i-peak.index);
+    return 
+        (i >= 0) && (i < N) && 
+        (std::min(distance, N-distance) > exclusion) && 
+        (x[i] == ref_value) && (peak.second_value == ref_value);
+}
+
+// Pick a peak within the exclusion width of either end most of the time since the search wraps around there
+// and put values just below the peak inside its exclusion zone so any leak into the zone is caught
+static int PlantPeak(rng_t& rng, float* x, const int N, const int exclusion) {
+    const int edge = std::min(N-1, exclusion);
+    int index = 0;
+    switch (std::uniform_int_distribution<int>(0, 2)(rng)) {
+    case 0:  index = std::uniform_int_distribution<int>(0, edge)(rng); break;
+    case 1:  index = std::uniform_int_distribution<int>(N-1-edge, N-1)(rng); break;
+    default: index = std::uniform_int_distribution<int>(0, N-1)(rng); break;
+    }
+    for (int k = 1; k <= exclusion; k++) {
+        x[(index+k) % N] = 10.0f - 0.001f*float(k);
+        x[(index-k+N) % N] = 10.0f - 0.001f*float(k);
+    }
+    x[index] = 20.0f;
+    return index;
+}
+
+static void TestVecSecondPeak(Context& ctx, const bool is_check) {
+    const char* name = "f32_vec_second_peak";
+    const auto kernels = GET_AUTO_KERNEL(f32_vec_second_peak_auto);
+    if (!is_check) return;
+    RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+        if (N == 0) return true;
+        auto x = TestBuffer<float>(N, misalign);
+        FillRandom(ctx.rng, x.get(), N);
+        const int exclusion = std::uniform_int_distribution<int>(0, N/2+1)(ctx.rng);
+        vec_peak_t peak;
+        peak.index = PlantPeak(ctx.rng, x.get(), N, exclusion);
+        peak.value = x[peak.index];
+        func(x.get(), N, exclusion, peak);
+        return GetIsSecondPeakCorrect(x.get(), N, exclusion, peak);
+    });
+}
+
+static void TestVecMagPeak(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mag_peak";
+    const auto kernels = GET_AUTO_KERNEL(c32_vec_mag_peak_auto<>);
+    constexpr float scale = 0.5f;
+    if (is_check) {
+        for (const bool is_squared: { false, true }) {
+            const char* check_name = is_squared ? "c32_vec_mag_peak(sq)" : name;
+            const auto check = [&](auto func, const int N, const int misalign) {
+                if (N == 0) return true;
+                auto x = TestBuffer<cf>(N, misalign);
+                auto y = TestBuffer<float>(N, MAX_MISALIGN-misalign);
+                FillRandom(ctx.rng, x.get(), N);
+                // The planted magnitudes are put on the real axis
+                std::vector<float> magnitude(N);
+                for (int i = 0; i < N; i++) magnitude[i] = std::abs(x[i]);
+                const int exclusion = std::uniform_int_distribution<int>(0, N/2+1)(ctx.rng);
+                const int index = PlantPeak(ctx.rng, magnitude.data(), N, exclusion);
+                for (int i = 0; i < N; i++) {
+                    if (magnitude[i] >= 10.0f) x[i] = cf(magnitude[i], 0.0f);
+                }
+                const auto peak = func(x.get(), y.get(), N, scale, is_squared, exclusion);
+                bool is_pass = y.GetIsGuardIntact();
+                double ref_sum = 0.0;
+                for (int i = 0; i < N; i++) {
+                    double v = std::norm(std::complex<double>(x[i]));
+                    if (!is_squared) v = std::sqrt(v);
+                    v = v*double(scale);
+                    ref_sum += v;
+                    is_pass = is_pass && GetIsClose(y[i], v, 1e-5);
+                }
+                is_pass = is_pass && (peak.index == index) && (peak.value == y[index]);
+                is_pass = is_pass && GetIsClose(peak.mean, ref_sum/double(N), 1e-4);
+                is_pass = is_pass && GetIsSecondPeakCorrect(y.get(), N, exclusion, peak);
+                return is_pass;
+            };
+            RunCheck(ctx, check_name, kernels, check);
+            ForEachFixedSize<1024, 2048, 4096, 8192>([&](auto size) {
+                constexpr int N_FIXED = decltype(size)::value;
+                RunFixedCheck(ctx, check_name, N_FIXED, GET_AUTO_KERNEL(c32_vec_mag_peak_auto<N_FIXED>), check);
+            });
+        }
+    }
+    if (is_bench) {
+        auto x = AlignedVector<cf>(ctx.bench_size);
+        auto y = AlignedVector<float>(ctx.bench_size);
+        FillRandom(ctx.rng, x.data(), ctx.bench_size);
+        volatile float sink = 0.0f;
+        RunBench(ctx, name, kernels, sizeof(cf)+sizeof(float), [&](auto func, const int N) {
+            const auto peak = func(x.data(), y.data(), N, 1.0f, false, 4);
+            sink = peak.second_value;
+        });
+    }
+}
+
+static void TestVecMixOscillator(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_mix_oscillator";
+    const auto kernels = GET_KERNELS(c32_vec_mix_oscillator);
+    auto phase_dist = std::uniform_real_distribution<float>(-3.0f, 3.0f);
+    auto step_dist = std::uniform_real_distribution<float>(-0.1f, 0.1f);
+    if (is_check) {
+        RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+            auto x = TestBuffer<cf>(N, misalign);
+            auto y = TestBuffer<cf>(N, MAX_MISALIGN-misalign);
+            FillRandom(ctx.rng, x.get(), N);
+            const float phase = phase_dist(ctx.rng);
+            const float step = step_dist(ctx.rng);
+            func(x.get(), y.get(), phase, step, N);
+            bool is_pass = y.GetIsGuardIntact();
+            for (int i = 0; i < N; i++) {
+                const double dt = double(phase) + double(step)*double(i);
+                const auto ref = std::complex<double>(x[i]) * std::polar(1.0, dt);
+                is_pass = is_pass && GetIsClose(y[i], ref, 1e-4);
+            }
+            return is_pass;
+        });
+    }
+    if (is_bench) {
+        auto x = AlignedVector<cf>(ctx.bench_size);
+        auto y = AlignedVector<cf>(ctx.bench_size);
+        FillRandom(ctx.rng, x.data(), ctx.bench_size);
+        RunBench(ctx, name, kernels, 2*sizeof(cf), [&](auto func, const int N) {
+            func(x.data(), y.data(), 0.1f, 0.01f, N);
+        });
+    }
+}
+
+static void TestVecOscillator(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "c32_vec_oscillator";
+    const auto kernels = GET_KERNELS(c32_vec_oscillator);
+    auto phase_dist = std::uniform_real_distribution<float>(-3.0f, 3.0f);
+    auto step_dist = std::uniform_real_distribution<float>(-0.1f, 0.1f);
+    if (is_check) {
+        RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+            auto y = TestBuffer<cf>(N, misalign);
+            const float phase = phase_dist(ctx.rng);
+            const float step = step_dist(ctx.rng);
+            func(y.get(), phase, step, N);
+            bool is_pass = y.GetIsGuardIntact();
+            for (int i = 0; i < N; i++) {
+                const double dt = double(phase) + double(step)*double(i);
+                is_pass = is_pass && GetIsClose(y[i], std::polar(1.0, dt), 1e-4);
+            }
+            return is_pass;
+        });
+    }
+    if (is_bench) {
+        auto y = AlignedVector<cf>(ctx.bench_size);
+        RunBench(ctx, name, kernels, sizeof(cf), [&](auto func, const int N) {
+            func(y.data(), 0.1f, 0.01f, N);
+        });
+    }
+}
+
+template <typename T>
+static void TestIQ8Convert(Context& ctx, const bool is_check, const bool is_bench, const char* name, const std::vector<Kernel<cf(*)(const std::complex<T>*, cf*, int, cf, float)>>& kernels) {
+    const auto offset = cf(3.25f, -1.5f);
+    constexpr float scale = 1.0f/127.5f;
+    if (is_check) {
+        RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+            auto x = TestBuffer<std::complex<T>>(N, misalign);
+            auto y = TestBuffer<cf>(N, MAX_MISALIGN-misalign);
+            FillRandomBytes(ctx.rng, x.get(), N);
+            const cf residual = func(x.get(), y.get(), N, offset, scale);
+            bool is_pass = y.GetIsGuardIntact();
+            std::complex<double> ref_residual = 0.0;
+            for (int i = 0; i < N; i++) {
+                const auto v = std::complex<double>(double(x[i].real()), double(x[i].imag())) - std::complex<double>(offset);
+                ref_residual += v;
+                is_pass = is_pass && GetIsClose(y[i], v*double(scale), 1e-6);
+            }
+            is_pass = is_pass && GetIsClose(residual, ref_residual, 1e-5);
+            return is_pass;
+        });
+    }
+    if (is_bench) {
+        auto x = AlignedVector<std::complex<T>>(ctx.bench_size);
+        auto y = AlignedVector<cf>(ctx.bench_size);
+        FillRandomBytes(ctx.rng, x.data(), ctx.bench_size);
+        volatile float sink = 0.0f;
+        RunBench(ctx, name, kernels, sizeof(std::complex<T>)+sizeof(cf), [&](auto func, const int N) {
+            sink = func(x.data(), y.data(), N, offset, scale).real();
+        });
+    }
+}
+
+static void TestS8ToU8Convert(Context& ctx, const bool is_check, const bool is_bench) {
+    const char* name = "s8_to_u8_vec_convert";
+    const auto kernels = GET_KERNELS(s8_to_u8_vec_convert);
+    if (is_check) {
+        RunCheck(ctx, name, kernels, [&](auto func, const int N, const int misalign) {
+            auto x = TestBuffer<int8_t>(N, misalign);
+            auto y = TestBuffer<uint8_t>(N, MAX_MISALIGN-misalign);
+            FillRandomBytes(ctx.rng, x.get(), N);
+            func(x.get(), y.get(), N);
+            bool is_pass = y.GetIsGuardIntact();
+            for (int i = 0; i < N; i++) {
+                is_pass = is_pass && (y[i] == uint8_t(int(x[i])+127));
+            }
+            return is_pass;
+        });
+    }
+    if (is_bench) {
+        auto x = AlignedVector<int8_t>(ctx.bench_size);
+        auto y = AlignedVector<uint8_t>(ctx.bench_size);
+        FillRandomBytes(ctx.rng, x.data(), ctx.bench_size);
+        RunBench(ctx, name, kernels, 2, [&](auto func, const int N) {
+            func(x.data(), y.data(), N);
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* mode = "all";
+    int total_random_sizes = 500;
+    int seed = 0;
+    int bench_size = 2048;
+    int bench_runs = 10000;
+
+    int opt;
+    while ((opt = getopt_custom(argc, argv, "m:t:s:b:r:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            mode = optarg;
+            break;
+        case 't':
+            total_random_sizes = (int)atof(optarg);
+            break;
+        case 's':
+            seed = (int)atof(optarg);
+            break;
+        case 'b':
+            bench_size = (int)atof(optarg);
+            break;
+        case 'r':
+            bench_runs = (int)atof(optarg);
+            break;
+        case 'h':
+        default:
+            usage();
+            return 0;
+        }
+    }
+
+    const bool is_all = strcmp(mode, "all") == 0;
+    const bool is_check = is_all || (strcmp(mode, "check") == 0);
+    const bool is_bench = is_all || (strcmp(mode, "bench") == 0);
+    if (!is_check && !is_bench) {
+        fprintf(stderr, "Got invalid mode '%s'\n", mode);
+        return 1;
+    }
+    if (total_random_sizes < 0) {
+        fprintf(stderr, "Got invalid total random sizes %d < 0\n", total_random_sizes);
+        return 1;
+    }
+    if (bench_size <= 0) {
+        fprintf(stderr, "Got invalid benchmark block size %d <= 0\n", bench_size);
+        return 1;
+    }
+    if (bench_runs <= 0) {
+        fprintf(stderr, "Got invalid benchmark runs %d <= 0\n", bench_runs);
+        return 1;
+    }
+
+    Context ctx;
+    ctx.rng = rng_t(uint32_t(seed));
+    ctx.total_random_sizes = total_random_sizes;
+    ctx.bench_size = bench_size;
+    ctx.bench_runs = bench_runs;
+
+    fprintf(stderr, "Running kernels up to '%s' with seed=%d\n", dsp_get_simd_level_name(dsp_get_simd_level()), seed);
+    TestVecMul(ctx, is_check, is_bench);
+    TestVecMulTiled(ctx, is_check, is_bench);
+    TestVecDot(ctx, is_check, is_bench);
+    TestVecMagAccumulate(ctx, is_check, is_bench);
+    TestVecArgmax(ctx, is_check, is_bench);
+    TestVecMagArgmax(ctx, is_check, is_bench);
+    TestVecSecondPeak(ctx, is_check);
+    TestVecMagPeak(ctx, is_check, is_bench);
+    TestVecMixOscillator(ctx, is_check, is_bench);
+    TestVecOscillator(ctx, is_check, is_bench);
+    TestIQ8Convert<uint8_t>(ctx, is_check, is_bench, "cu8_to_c32_vec_convert", GET_KERNELS(cu8_to_c32_vec_convert));
+    TestIQ8Convert<int8_t>(ctx, is_check, is_bench, "cs8_to_c32_vec_convert", GET_KERNELS(cs8_to_c32_vec_convert));
+    TestS8ToU8Convert(ctx, is_check, is_bench);
+
+    if (ctx.total_failures > 0) {
+        fprintf(stderr, "Got %d failed checks\n", ctx.total_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "utility/basic_thread_pool.h"
+#include "utility/work_stealing_pool.h"
+#include "utility/getopt/getopt.h"
+
+void usage() {
+    fprintf(stderr,
+        "thread_pool_bench, Compares fork-join latency of the work stealing pool against the basic thread pool\n\n"
+        "\t[-t total threads (default: hardware concurrency)]\n"
+        "\t[-n tasks per fork-join (default: 32)]\n"
+        "\t[-w busy work per task in nanoseconds (default: 0)]\n"
+        "\t[-p idle period between fork-joins in microseconds (default: 0)]\n"
+        "\t[-r fork-joins per measurement (default: 10000)]\n"
+        "\t[-s time idle work stealing threads spin before sleeping in microseconds (default: 100)]\n"
+        "\t[-h (show usage)]\n"
+    );
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+static int64_t GetNanoseconds(const bench_clock::time_point start, const bench_clock::time_point end) {
+    return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
+}
+
+static void BusyWait(const int64_t total_ns) {
+    const auto start = bench_clock::now();
+    while (GetNanoseconds(start, bench_clock::now()) < total_ns);
+}
+
+struct Context {
+    int total_tasks;
+    int work_ns;
+    int idle_period_us;
+    int total_runs;
+};
+
+// Timestamps of a single fork-join
+// dispatch: submit until the first task starts
+// join: last task finishes until the caller returns
+struct Timings {
+    std::vector<int64_t> dispatch_ns;
+    std::vector<int64_t> join_ns;
+    std::vector<int64_t> total_ns;
+};
+
+static void PrintStatistics(const char* pool_name, const char* name, std::vector<int64_t>& x) {
+    std::sort(x.begin(), x.end());
+    const size_t N = x.size();
+    double mean = 0.0;
+    for (auto v: x) mean += (double)v;
+    mean /= (double)N;
+    const auto percentile = [&](const double p) { return x[std::min(N-1, size_t(p*double(N)))]; };
+    printf("%-14s %-9s mean=%9.0fns p50=%8lldns p90=%8lldns p99=%8lldns\n",
+        pool_name, name, mean,
+        (long long)percentile(0.5), (long long)percentile(0.9), (long long)percentile(0.99));
+}
+
+// Calls fork_join(task) where task(i) has to be run for i in [0, total_tasks)
+template <typename G>
+static void RunBench(const Context& ctx, const char* pool_name, G&& fork_join) {
+    const size_t N = (size_t)ctx.total_tasks;
+    std::vector<bench_clock::time_point> task_starts(N);
+    std::vector<bench_clock::time_point> task_ends(N);
+    const auto task = [&](const size_t i) {
+        task_starts[i] = bench_clock::now();
+        if (ctx.work_ns > 0) BusyWait(ctx.work_ns);
+        task_ends[i] = bench_clock::now();
+    };
+
+    Timings timings;
+    timings.dispatch_ns.reserve(ctx.total_runs);
+    timings.join_ns.reserve(ctx.total_runs);
+    timings.total_ns.reserve(ctx.total_runs);
+    for (int run = 0; run < ctx.total_runs; run++) {
+        if (ctx.idle_period_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(ctx.idle_period_us));
+        }
+        const auto start = bench_clock::now();
+        fork_join(task);
+        const auto end = bench_clock::now();
+        const auto first_start = *std::min_element(task_starts.begin(), task_starts.end());
+        const auto last_end = *std::max_element(task_ends.begin(), task_ends.end());
+        timings.dispatch_ns.push_back(GetNanoseconds(start, first_start));
+        timings.join_ns.push_back(GetNanoseconds(last_end, end));
+        timings.total_ns.push_back(GetNanoseconds(start, end));
+    }
+
+    PrintStatistics(pool_name, "dispatch", timings.dispatch_ns);
+    PrintStatistics(pool_name, "join", timings.join_ns);
+    PrintStatistics(pool_name, "total", timings.total_ns);
+}
+
+int main(int argc, char** argv) {
+    int total_threads = (int)std::thread::hardware_concurrency();
+    int total_tasks = 32;
+    int work_ns = 0;
+    int idle_period_us = 0;
+    int total_runs = 10000;
+    int spin_duration_us = (int)WorkStealingPool::DEFAULT_SPIN_DURATION_US;
+
+    int opt;
+    while ((opt = getopt_custom(argc, argv, "t:n:w:p:r:s:h")) != -1) {
+        switch (opt) {
+        case 't':
+            total_threads = (int)atof(optarg);
+            break;
+        case 'n':
+            total_tasks = (int)atof(optarg);
+            break;
+        case 'w':
+            work_ns = (int)atof(optarg);
+            break;
+        case 'p':
+            idle_period_us = (int)atof(optarg);
+            break;
+        case 'r':
+            total_runs = (int)atof(optarg);
+            break;
+        case 's':
+            spin_duration_us = (int)atof(optarg);
+            break;
+        case 'h':
+        default:
+            usage();
+            return 0;
+        }
+    }
+
+    if (total_threads <= 0) {
+        fprintf(stderr, "Got invalid total threads %d <= 0\n", total_threads);
+        return 1;
+    }
+    if (total_tasks <= 0) {
+        fprintf(stderr, "Got invalid total tasks %d <= 0\n", total_tasks);
+        return 1;
+    }
+    if (work_ns < 0) {
+        fprintf(stderr, "Got invalid busy work %d < 0\n", work_ns);
+        return 1;
+    }
+    if (idle_period_us < 0) {
+        fprintf(stderr, "Got invalid idle period %d < 0\n", idle_period_us);
+        return 1;
+    }
+    if (total_runs <= 0) {
+        fprintf(stderr, "Got invalid total runs %d <= 0\n", total_runs);
+        return 1;
+    }
+    if (spin_duration_us < 0) {
+        fprintf(stderr, "Got invalid spin time %d < 0\n", spin_duration_us);
+        return 1;
+    }
+
+    Context ctx;
+    ctx.total_tasks = total_tasks;
+    ctx.work_ns = work_ns;
+    ctx.idle_period_us = idle_period_us;
+    ctx.total_runs = total_runs;
+
+    fprintf(stderr, "Running %d fork-joins of %d tasks with %dns of work on %d threads\n",
+        total_runs, total_tasks, work_ns, total_threads);
+
+    {
+        BasicThreadPool pool((size_t)total_threads);
+        RunBench(ctx, "basic", [&](auto& task) {
+            for (size_t i = 0; i < (size_t)total_tasks; i++) {
+                pool.PushTask([&task, i]() { task(i); });
+            }
+            pool.WaitAll();
+        });
+    }
+
+    {
+        WorkStealingPool pool((size_t)total_threads);
+        pool.SetSpinDuration(std::chrono::microseconds(spin_duration_us));
+        RunBench(ctx, "work_stealing", [&](auto& task) {
+            pool.ParallelFor((size_t)total_tasks, task);
+        });
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Bounded multi-producer multi-consumer queue
+// Each cell has a sequence number that tells producers and consumers whose turn it is
+// so pushing and popping only takes a compare and swap on the queue position
+// NOTE: Push and Pop spin for a while before blocking on a condition variable
+//       The notify is skipped when no thread is blocked so the lock is off the fast path
+template <typename T>
+class BoundedQueue
+{
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    static constexpr int TOTAL_SPINS_BEFORE_YIELD = 1 << 6;
+    static constexpr int TOTAL_SPINS_BEFORE_SLEEP = 1 << 10;
+
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<size_t> push_position;
+    alignas(64) std::atomic<size_t> pop_position;
+    alignas(64) std::atomic<bool> is_closed;
+    std::atomic<int> total_waiting;
+    std::mutex mutex_wait;
+    std::condition_variable cv_wait;
+public:
+    // capacity is rounded up to a power of 2
+    BoundedQueue(const size_t _capacity) {
+        capacity = 1;
+        while (capacity < _capacity) {
+            capacity *= 2;
+        }
+        mask = capacity-1;
+        cells = std::make_unique<Cell[]>(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        push_position = 0;
+        pop_position = 0;
+        is_closed = false;
+        total_waiting = 0;
+    }
+    BoundedQueue(BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+    BoundedQueue& operator=(BoundedQueue&) = delete;
+    BoundedQueue& operator=(BoundedQueue&&) = delete;
+    size_t GetCapacity() const { return capacity; }
+    // approximate when other threads are using the queue
+    size_t GetSize() const {
+        const size_t pop = pop_position.load(std::memory_order_relaxed);
+        const size_t push = push_position.load(std::memory_order_relaxed);
+        return (push > pop) ? (push-pop) : 0;
+    }
+    bool GetIsClosed() const { return is_closed.load(std::memory_order_acquire); }
+    bool TryPush(const T& x) {
+        size_t position = push_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = (intptr_t)sequence - (intptr_t)position;
+            if (diff == 0) {
+                if (push_position.compare_exchange_weak(position, position+1, std::memory_order_relaxed)) {
+                    cell.data = x;
+                    cell.sequence.store(position+1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = push_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool TryPop(T& x) {
+        size_t position = pop_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = (intptr_t)sequence - (intptr_t)(position+1);
+            if (diff == 0) {
+                if (pop_position.compare_exchange_weak(position, position+1, std::memory_order_relaxed)) {
+                    x = cell.data;
+                    cell.sequence.store(position+mask+1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = pop_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    // Blocks while the queue is full and returns false if the queue is closed
+    bool Push(const T& x) {
+        bool is_pushed = false;
+        WaitFor([this, &x, &is_pushed]() {
+            if (GetIsClosed()) {
+                return true;
+            }
+            is_pushed = TryPush(x);
+            return is_pushed;
+        });
+        if (is_pushed) {
+            Notify();
+        }
+        return is_pushed;
+    }
+    // Blocks while the queue is empty and returns false once the queue is closed and empty
+    bool Pop(T& x) {
+        bool is_popped = false;
+        WaitFor([this, &x, &is_popped]() {
+            // a closed queue is still drained
+            const bool is_closed_before = GetIsClosed();
+            is_popped = TryPop(x);
+            return is_popped || is_closed_before;
+        });
+        if (is_popped) {
+            Notify();
+        }
+        return is_popped;
+    }
+    // Wakes up blocked threads and stops any more items from being pushed
+    void Close() {
+        {
+            auto lock = std::scoped_lock(mutex_wait);
+            is_closed.store(true, std::memory_order_release);
+        }
+        cv_wait.notify_all();
+    }
+private:
+    template <typename F>
+    void WaitFor(F&& is_done) {
+        for (int i = 0; i < TOTAL_SPINS_BEFORE_SLEEP; i++) {
+            if (is_done()) {
+                return;
+            }
+            if (i >= TOTAL_SPINS_BEFORE_YIELD) {
+                std::this_thread::yield();
+            }
+        }
+
+        auto lock = std::unique_lock(mutex_wait);
+        total_waiting.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_wait.wait(lock, is_done);
+        total_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void Notify() {
+        // pairs with the fence in WaitFor so either the waiter sees our change or we see the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (total_waiting.load(std::memory_order_relaxed) > 0) {
+            { auto lock = std::scoped_lock(mutex_wait); }
+            cv_wait.notify_all();
+        }
+    }
+};
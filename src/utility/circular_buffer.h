@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include "utility/span.h"
 
 template <typename T>
@@ -25,10 +26,14 @@ public:
             nb_read = (N > N_remain) ? N_remain : N;
         }
 
-        for (int i = 0; i < nb_read; i++) {
-            buf[index++] = src[i];
-            index = index % capacity;
-        }
+        // copy in at most two contiguous pieces since only the last capacity elements are kept
+        const size_t nb_skip = (nb_read > capacity) ? (nb_read-capacity) : 0;
+        const size_t nb_copy = nb_read-nb_skip;
+        const size_t start = (index+nb_skip) % capacity;
+        const size_t nb_first = std::min(nb_copy, capacity-start);
+        std::copy_n(src.data()+nb_skip, nb_first, buf.data()+start);
+        std::copy_n(src.data()+nb_skip+nb_first, nb_copy-nb_first, buf.data());
+        index = (index+nb_read) % capacity;
         length += nb_read;
         if (length > capacity) {
             length = capacity;
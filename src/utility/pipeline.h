@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+
+// Streaming pipeline where each stage runs on its own threads and hands blocks to the next stage over a bounded queue
+// Blocks are indices into a pool owned by the caller which go from the first stage to the last and then back again
+// so the number of blocks in flight is fixed and no stage allocates
+// NOTE: The first stage is the source which runs on a single thread
+//       When the source returns false, e.g. once it runs out of data, the blocks in flight are finished
+//       When any other stage returns false the pipeline stops without finishing them
+// NOTE: Blocks leave a stage in the order they entered it even if the stage has many threads
+//       Stages that keep state from one block to the next should use a single thread
+class Pipeline
+{
+public:
+    using StageFunc = std::function<bool(const size_t block_index)>;
+    struct StageStats {
+        const char* name;
+        size_t total_threads;
+        uint64_t total_blocks;
+        // average time spent in the stage function
+        double average_busy_us;
+        // blocks waiting to enter the stage
+        size_t total_queued;
+    };
+private:
+    struct Item {
+        size_t block_index;
+        uint64_t sequence;
+    };
+    struct Stage {
+        std::string name;
+        size_t nb_threads;
+        StageFunc func;
+        // the first stage takes its blocks from the free list
+        std::unique_ptr<BoundedQueue<Item>> input;
+        // sequence number of the next block allowed to leave the stage
+        std::atomic<uint64_t> output_sequence {0};
+        std::atomic<size_t> total_running {0};
+        std::atomic<uint64_t> total_blocks {0};
+        std::atomic<uint64_t> total_busy_ns {0};
+        std::vector<std::thread> threads;
+    };
+    const size_t total_blocks;
+    std::vector<std::unique_ptr<Stage>> stages;
+    bool is_started;
+    std::atomic<bool> is_running;
+public:
+    Pipeline(const size_t _total_blocks)
+    : total_blocks(_total_blocks), is_started(false), is_running(false)
+    {
+        assert(total_blocks > 0);
+    }
+    ~Pipeline() {
+        Stop();
+    }
+    Pipeline(Pipeline&) = delete;
+    Pipeline(Pipeline&&) = delete;
+    Pipeline& operator=(Pipeline&) = delete;
+    Pipeline& operator=(Pipeline&&) = delete;
+    size_t GetTotalBlocks() const { return total_blocks; }
+    size_t GetTotalStages() const { return stages.size(); }
+    bool GetIsRunning() const { return is_running; }
+    void AddStage(const char* name, const size_t nb_threads, StageFunc func) {
+        assert(!is_started);
+        assert(nb_threads > 0);
+        auto stage = std::make_unique<Stage>();
+        stage->name = name;
+        stage->nb_threads = stages.empty() ? 1 : nb_threads;
+        stage->func = std::move(func);
+        stage->input = std::make_unique<BoundedQueue<Item>>(total_blocks);
+        stages.push_back(std::move(stage));
+    }
+    void Start() {
+        assert(!is_started);
+        assert(!stages.empty());
+        is_started = true;
+        is_running = true;
+
+        // every block starts off free
+        auto& free_blocks = *stages[0]->input;
+        for (size_t i = 0; i < total_blocks; i++) {
+            free_blocks.TryPush({ i, 0 });
+        }
+
+        const size_t total_stages = stages.size();
+        for (size_t i = 0; i < total_stages; i++) {
+            auto& stage = *stages[i];
+            stage.total_running = stage.nb_threads;
+            for (size_t j = 0; j < stage.nb_threads; j++) {
+                stage.threads.emplace_back(&Pipeline::RunnerThread, this, i);
+            }
+        }
+    }
+    // Blocks until the source has stopped and every block it produced has gone through the pipeline
+    void Wait() {
+        for (auto& stage: stages) {
+            for (auto& thread: stage->threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+        is_running = false;
+    }
+    // Stops every stage without waiting for blocks in flight
+    // NOTE: A stage function that is blocked, e.g. on a read, has to return before this does
+    void Stop() {
+        is_running = false;
+        for (auto& stage: stages) {
+            stage->input->Close();
+        }
+        Wait();
+    }
+    StageStats GetStageStats(const size_t index) const {
+        const auto& stage = *stages[index];
+        StageStats stats;
+        stats.name = stage.name.c_str();
+        stats.total_threads = stage.nb_threads;
+        stats.total_blocks = stage.total_blocks.load(std::memory_order_relaxed);
+        const uint64_t busy_ns = stage.total_busy_ns.load(std::memory_order_relaxed);
+        stats.average_busy_us = (stats.total_blocks > 0) ? (double)busy_ns*1e-3 / (double)stats.total_blocks : 0.0;
+        stats.total_queued = (index > 0) ? stage.input->GetSize() : 0;
+        return stats;
+    }
+private:
+    void RunnerThread(const size_t stage_index) {
+        auto& stage = *stages[stage_index];
+        const size_t total_stages = stages.size();
+        const bool is_source = (stage_index == 0);
+        const bool is_sink = (stage_index == (total_stages-1));
+        // the last stage returns blocks to the free list
+        auto& output = *stages[is_sink ? 0 : (stage_index+1)]->input;
+        uint64_t source_sequence = 0;
+
+        Item item;
+        while (stage.input->Pop(item)) {
+            if (!is_running) {
+                break;
+            }
+            if (is_source) {
+                item.sequence = source_sequence++;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            const bool is_continue = stage.func(item.block_index);
+            const auto end = std::chrono::steady_clock::now();
+            const auto busy_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
+            stage.total_busy_ns.fetch_add((uint64_t)busy_ns, std::memory_order_relaxed);
+            stage.total_blocks.fetch_add(1, std::memory_order_relaxed);
+
+            if (!is_continue) {
+                if (is_source) {
+                    break;
+                }
+                is_running = false;
+            }
+
+            // keep the order of blocks when there are many threads in the stage
+            while (stage.output_sequence.load(std::memory_order_acquire) != item.sequence) {
+                if (!is_running) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+            const bool is_pushed = output.Push(item);
+            stage.output_sequence.store(item.sequence+1, std::memory_order_release);
+            if (!is_pushed || !is_running) {
+                break;
+            }
+        }
+
+        // downstream stages finish the blocks that are queued once every thread of this stage is done
+        if (stage.total_running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (!is_sink) {
+                output.Close();
+            }
+        }
+    }
+};
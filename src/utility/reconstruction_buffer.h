@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include "utility/span.h"
 
 // reconstruct a block of size M from blocks of size N
@@ -17,10 +18,7 @@ public:
         const size_t N = src.size();
         const size_t N_required = Capacity()-length;
         const size_t nb_read = (N_required >= N) ? N : N_required;
-        auto wr_buf = buf.subspan(length, nb_read);
-        for (int i = 0; i < nb_read; i++) {
-            wr_buf[i] = src[i];
-        }
+        std::copy_n(src.data(), nb_read, buf.data()+length);
         length += nb_read;
         return nb_read;
     }
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include "utility/span.h"
+
+// Single producer single consumer ring buffer for handing samples from one thread to another
+// Each side reserves a contiguous region, reads or writes it directly, e.g. with fread or memcpy, then commits it
+// NOTE: A reserved region stops at the end of the buffer so a transfer can take two reserve and commit pairs
+//       The producer and consumer indices are on separate cache lines and each side keeps a cached copy
+//       of the other's index so it only touches the other cache line when it runs out of room
+template <typename T>
+class SPSC_RingBuffer
+{
+public:
+    struct Stats {
+        size_t capacity;
+        // elements committed but not yet read
+        size_t fill;
+        size_t max_fill;
+        uint64_t total_written;
+        uint64_t total_read;
+        // number of times the producer had to wait for room or the consumer had to wait for data
+        uint64_t total_write_stalls;
+        uint64_t total_read_stalls;
+    };
+private:
+    static_assert(std::is_trivially_copyable_v<T>, "Ring buffer elements are copied with memcpy");
+    static constexpr int TOTAL_SPINS_BEFORE_SLEEP = 1 << 6;
+
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<T[]> buf;
+    // producer
+    alignas(64) std::atomic<size_t> write_index;
+    size_t cached_read_index;
+    std::atomic<size_t> max_fill;
+    std::atomic<uint64_t> total_write_stalls;
+    // consumer
+    alignas(64) std::atomic<size_t> read_index;
+    size_t cached_write_index;
+    std::atomic<uint64_t> total_read_stalls;
+    // blocking
+    alignas(64) std::atomic<bool> is_closed;
+    std::atomic<int> total_waiting;
+    std::mutex mutex_wait;
+    std::condition_variable cv_wait;
+public:
+    // capacity is rounded up to a power of 2
+    SPSC_RingBuffer(const size_t _capacity) {
+        capacity = 1;
+        while (capacity < _capacity) {
+            capacity *= 2;
+        }
+        mask = capacity-1;
+        buf = std::make_unique<T[]>(capacity);
+        write_index = 0;
+        cached_read_index = 0;
+        max_fill = 0;
+        total_write_stalls = 0;
+        read_index = 0;
+        cached_write_index = 0;
+        total_read_stalls = 0;
+        is_closed = false;
+        total_waiting = 0;
+    }
+    SPSC_RingBuffer(SPSC_RingBuffer&) = delete;
+    SPSC_RingBuffer(SPSC_RingBuffer&&) = delete;
+    SPSC_RingBuffer& operator=(SPSC_RingBuffer&) = delete;
+    SPSC_RingBuffer& operator=(SPSC_RingBuffer&&) = delete;
+    size_t GetCapacity() const { return capacity; }
+    bool GetIsClosed() const { return is_closed.load(std::memory_order_acquire); }
+    // approximate when other threads are using the buffer
+    Stats GetStats() const {
+        Stats stats;
+        stats.capacity = capacity;
+        stats.total_read = read_index.load(std::memory_order_relaxed);
+        stats.total_written = write_index.load(std::memory_order_relaxed);
+        stats.fill = (stats.total_written > stats.total_read) ? size_t(stats.total_written-stats.total_read) : 0;
+        stats.max_fill = max_fill.load(std::memory_order_relaxed);
+        stats.total_write_stalls = total_write_stalls.load(std::memory_order_relaxed);
+        stats.total_read_stalls = total_read_stalls.load(std::memory_order_relaxed);
+        return stats;
+    }
+    // Producer: contiguous free region of at most max_length elements which may be empty
+    tcb::span<T> ReserveWrite(const size_t max_length) {
+        const size_t index = write_index.load(std::memory_order_relaxed);
+        size_t total_free = capacity - (index-cached_read_index);
+        if (total_free < max_length) {
+            cached_read_index = read_index.load(std::memory_order_acquire);
+            total_free = capacity - (index-cached_read_index);
+        }
+        const size_t offset = index & mask;
+        const size_t length = std::min({ max_length, total_free, capacity-offset });
+        return tcb::span<T>(buf.get()+offset, length);
+    }
+    // Producer: publishes the first length elements of the last reserved region
+    void CommitWrite(const size_t length) {
+        const size_t index = write_index.load(std::memory_order_relaxed) + length;
+        assert((index-cached_read_index) <= capacity);
+        write_index.store(index, std::memory_order_release);
+        const size_t fill = index-read_index.load(std::memory_order_relaxed);
+        if (fill > max_fill.load(std::memory_order_relaxed)) {
+            max_fill.store(fill, std::memory_order_relaxed);
+        }
+        Notify();
+    }
+    // Consumer: contiguous region of at most max_length committed elements which may be empty
+    tcb::span<const T> ReserveRead(const size_t max_length) {
+        const size_t index = read_index.load(std::memory_order_relaxed);
+        size_t total_used = cached_write_index-index;
+        if (total_used < max_length) {
+            cached_write_index = write_index.load(std::memory_order_acquire);
+            total_used = cached_write_index-index;
+        }
+        const size_t offset = index & mask;
+        const size_t length = std::min({ max_length, total_used, capacity-offset });
+        return tcb::span<const T>(buf.get()+offset, length);
+    }
+    // Consumer: frees the first length elements of the last reserved region
+    void CommitRead(const size_t length) {
+        const size_t index = read_index.load(std::memory_order_relaxed) + length;
+        assert(index <= cached_write_index);
+        read_index.store(index, std::memory_order_release);
+        Notify();
+    }
+    // Producer: blocks until there is room for length elements and returns false if the buffer is closed
+    // NOTE: Waiting for more room than the consumer waits for data can deadlock
+    bool WaitForWrite(const size_t length) {
+        assert(length <= capacity);
+        const auto is_ready = [this, length]() {
+            const size_t used = write_index.load(std::memory_order_relaxed) - read_index.load(std::memory_order_acquire);
+            return (capacity-used) >= length;
+        };
+        if (is_ready()) {
+            return !GetIsClosed();
+        }
+        total_write_stalls.fetch_add(1, std::memory_order_relaxed);
+        WaitFor([this, &is_ready]() { return GetIsClosed() || is_ready(); });
+        return !GetIsClosed();
+    }
+    // Consumer: blocks until length elements are committed and returns false if the buffer was closed before then
+    bool WaitForRead(const size_t length) {
+        assert(length <= capacity);
+        const auto is_ready = [this, length]() {
+            const size_t used = write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_relaxed);
+            return used >= length;
+        };
+        if (is_ready()) {
+            return true;
+        }
+        total_read_stalls.fetch_add(1, std::memory_order_relaxed);
+        WaitFor([this, &is_ready]() {
+            // data committed before the buffer was closed is still read
+            const bool is_closed_before = GetIsClosed();
+            return is_ready() || is_closed_before;
+        });
+        return is_ready();
+    }
+    // Producer: copies all of x unless the buffer is closed and returns the number of elements written
+    // NOTE: Copies happen as soon as there is any room so the producer and consumer never wait on each other
+    size_t Write(tcb::span<const T> x) {
+        size_t total_written = 0;
+        while (total_written < x.size()) {
+            const size_t remain = x.size()-total_written;
+            if (!WaitForWrite(1)) {
+                break;
+            }
+            auto region = ReserveWrite(remain);
+            memcpy(region.data(), x.data()+total_written, region.size()*sizeof(T));
+            CommitWrite(region.size());
+            total_written += region.size();
+        }
+        return total_written;
+    }
+    // Consumer: fills all of y unless the buffer is closed and returns the number of elements read
+    size_t Read(tcb::span<T> y) {
+        size_t total_read = 0;
+        while (total_read < y.size()) {
+            const size_t remain = y.size()-total_read;
+            const bool is_ready = WaitForRead(1);
+            auto region = ReserveRead(remain);
+            memcpy(y.data()+total_read, region.data(), region.size()*sizeof(T));
+            CommitRead(region.size());
+            total_read += region.size();
+            if (!is_ready && region.empty()) {
+                break;
+            }
+        }
+        return total_read;
+    }
+    // Wakes up blocked threads and stops the producer
+    // NOTE: The consumer can still read what was committed before this
+    void Close() {
+        {
+            auto lock = std::scoped_lock(mutex_wait);
+            is_closed.store(true, std::memory_order_release);
+        }
+        cv_wait.notify_all();
+    }
+private:
+    template <typename F>
+    void WaitFor(F&& is_done) {
+        for (int i = 0; i < TOTAL_SPINS_BEFORE_SLEEP; i++) {
+            if (is_done()) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        auto lock = std::unique_lock(mutex_wait);
+        total_waiting.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv_wait.wait(lock, is_done);
+        total_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void Notify() {
+        // pairs with the fence in WaitFor so either the waiter sees our change or we see the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (total_waiting.load(std::memory_order_relaxed) > 0) {
+            { auto lock = std::scoped_lock(mutex_wait); }
+            cv_wait.notify_all();
+        }
+    }
+};
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+static inline void work_stealing_pause() { _mm_pause(); }
+#else
+static inline void work_stealing_pause() { std::this_thread::yield(); }
+#endif
+
+// Fork-join thread pool where each thread owns a deque of ranges and idle threads steal from the others
+// ParallelFor splits a range in half until it reaches the grain size, pushing the upper halves
+// onto the running thread's deque where they can be stolen by idle threads
+// NOTE: Tasks are plain descriptors into a job on the caller's stack so dispatch doesn't allocate
+//       The calling thread runs tasks too and spins until the job is done instead of sleeping
+//       ParallelFor must only be called from one thread at a time which isn't a worker
+class WorkStealingPool
+{
+private:
+    // a job is a type erased call to func(i) for each index of its range
+    struct Job {
+        void (*run)(void* func, size_t start, size_t end);
+        void* func;
+        size_t grain;
+        // indices left to run before the job is done
+        std::atomic<size_t> total_pending;
+    };
+
+    struct Task {
+        Job* job;
+        size_t start;
+        size_t end;
+    };
+
+    // Chase-Lev deque with a fixed capacity
+    // The owner pushes and pops from the bottom while thieves steal from the top
+    // NOTE: Splitting a range in half bounds the number of queued tasks to log2 of its size
+    //       If the deque is full the owner just runs the range itself
+    class TaskDeque {
+    private:
+        static constexpr int64_t CAPACITY = 256;
+        static constexpr int64_t MASK = CAPACITY-1;
+        // slots are atomic since a thief can read a slot the owner is reusing, in which case its steal fails
+        struct Slot {
+            std::atomic<Job*> job {nullptr};
+            std::atomic<size_t> start {0};
+            std::atomic<size_t> end {0};
+        };
+        alignas(64) std::atomic<int64_t> top {0};
+        alignas(64) std::atomic<int64_t> bottom {0};
+        alignas(64) Slot slots[CAPACITY];
+    public:
+        bool Push(const Task& task) {
+            const int64_t b = bottom.load(std::memory_order_relaxed);
+            const int64_t t = top.load(std::memory_order_acquire);
+            if ((b-t) >= CAPACITY) {
+                return false;
+            }
+            auto& slot = slots[b & MASK];
+            slot.job.store(task.job, std::memory_order_relaxed);
+            slot.start.store(task.start, std::memory_order_relaxed);
+            slot.end.store(task.end, std::memory_order_relaxed);
+            bottom.store(b+1, std::memory_order_release);
+            return true;
+        }
+        bool Pop(Task& task) {
+            const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b+1, std::memory_order_relaxed);
+                return false;
+            }
+            Read(b, task);
+            // the last task may be stolen at the same time
+            bool is_taken = true;
+            if (t == b) {
+                is_taken = top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b+1, std::memory_order_relaxed);
+            }
+            return is_taken;
+        }
+        bool Steal(Task& task) {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int64_t b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+            Read(t, task);
+            return top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+    private:
+        void Read(const int64_t i, Task& task) const {
+            const auto& slot = slots[i & MASK];
+            task.job = slot.job.load(std::memory_order_relaxed);
+            task.start = slot.start.load(std::memory_order_relaxed);
+            task.end = slot.end.load(std::memory_order_relaxed);
+        }
+    };
+
+    // threads yield their timeslice after this many spins in case the cpu is oversubscribed
+    static constexpr int TOTAL_SPINS_BEFORE_YIELD = 1 << 10;
+    // the clock is only read every so often while spinning
+    static constexpr int TOTAL_SPINS_PER_CLOCK_CHECK = 1 << 6;
+
+    // threads
+    std::atomic<bool> is_running;
+    size_t nb_threads;
+    // how long idle workers look for work before going to sleep
+    // NOTE: Spinning for longer than the gap between jobs keeps a core busy for each worker
+    //       while sleeping adds a wake up to the dispatch of the next job
+    std::atomic<int64_t> spin_duration_ns;
+    std::vector<std::thread> task_threads;
+    // deque 0 belongs to the calling thread and the rest to each worker
+    std::unique_ptr<TaskDeque[]> task_deques;
+    // sleeping workers are woken up when the job epoch changes
+    std::atomic<uint64_t> job_epoch;
+    std::atomic<int> total_sleeping;
+    std::mutex mutex_sleep;
+    std::condition_variable cv_wake;
+public:
+    static constexpr int64_t DEFAULT_SPIN_DURATION_US = 100;
+    // nb_threads includes the calling thread
+    WorkStealingPool(size_t _nb_threads=0) {
+        is_running = true;
+        spin_duration_ns = DEFAULT_SPIN_DURATION_US*1000;
+        job_epoch = 0;
+        total_sleeping = 0;
+        nb_threads = _nb_threads ? _nb_threads : std::thread::hardware_concurrency();
+        nb_threads = (nb_threads > 0) ? nb_threads : 1;
+        task_deques = std::make_unique<TaskDeque[]>(nb_threads);
+
+        task_threads.reserve(nb_threads-1);
+        for (size_t i = 1; i < nb_threads; i++) {
+            task_threads.emplace_back(&WorkStealingPool::RunnerThread, this, i);
+        }
+    }
+    ~WorkStealingPool() {
+        StopAll();
+    }
+    WorkStealingPool(WorkStealingPool&) = delete;
+    WorkStealingPool(WorkStealingPool&&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool&&) = delete;
+    size_t GetTotalThreads() const { return nb_threads; }
+    void SetSpinDuration(const std::chrono::microseconds duration) {
+        spin_duration_ns.store((int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+    }
+    std::chrono::microseconds GetSpinDuration() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(spin_duration_ns.load(std::memory_order_relaxed)));
+    }
+    void StopAll() {
+        if (!is_running) {
+            return;
+        }
+
+        {
+            auto lock = std::scoped_lock(mutex_sleep);
+            is_running = false;
+            job_epoch++;
+        }
+        cv_wake.notify_all();
+        for (auto& thread: task_threads) {
+            thread.join();
+        }
+    }
+    // Calls func(i) for i in [0, total) across all threads and returns once every call has finished
+    // Ranges are not split below grain indices
+    template <typename F>
+    void ParallelFor(const size_t total, F&& func, const size_t grain=1) {
+        if (total == 0) {
+            return;
+        }
+
+        Job job;
+        job.run = &RunRange<std::remove_reference_t<F>>;
+        job.func = const_cast<void*>(static_cast<const void*>(&func));
+        job.grain = (grain > 0) ? grain : 1;
+        job.total_pending.store(total, std::memory_order_relaxed);
+
+        // the caller starts on the whole range and splits off work for the woken threads
+        auto& deque = task_deques[0];
+        const bool is_pushed = deque.Push({ &job, 0, total });
+        assert(is_pushed);
+        (void)is_pushed;
+        WakeWorkers();
+
+        // barrier: help with any outstanding tasks until the job is done
+        int total_spins = 0;
+        while (job.total_pending.load(std::memory_order_acquire) > 0) {
+            if (RunNextTask(0)) {
+                total_spins = 0;
+                continue;
+            }
+            total_spins++;
+            if (total_spins < TOTAL_SPINS_BEFORE_YIELD) {
+                work_stealing_pause();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+private:
+    template <typename F>
+    static void RunRange(void* func, const size_t start, const size_t end) {
+        auto& f = *static_cast<F*>(func);
+        for (size_t i = start; i < end; i++) {
+            f(i);
+        }
+    }
+
+    void WakeWorkers() {
+        job_epoch.fetch_add(1, std::memory_order_seq_cst);
+        // avoid the syscall when every worker is still spinning
+        if (total_sleeping.load(std::memory_order_seq_cst) > 0) {
+            { auto lock = std::scoped_lock(mutex_sleep); }
+            cv_wake.notify_all();
+        }
+    }
+
+    // run a task from our own deque or steal one from another thread
+    bool RunNextTask(const size_t thread_index) {
+        Task task;
+        if (!task_deques[thread_index].Pop(task)) {
+            bool is_stolen = false;
+            for (size_t i = 1; i < nb_threads; i++) {
+                const size_t victim = (thread_index+i) % nb_threads;
+                if (task_deques[victim].Steal(task)) {
+                    is_stolen = true;
+                    break;
+                }
+            }
+            if (!is_stolen) {
+                return false;
+            }
+        }
+        RunTask(thread_index, task);
+        return true;
+    }
+
+    void RunTask(const size_t thread_index, Task task) {
+        Job& job = *task.job;
+        auto& deque = task_deques[thread_index];
+        while ((task.end-task.start) > job.grain) {
+            const size_t mid = task.start + (task.end-task.start)/2;
+            if (!deque.Push({ &job, mid, task.end })) {
+                break;
+            }
+            task.end = mid;
+        }
+        job.run(job.func, task.start, task.end);
+        // NOTE: The job lives on the caller's stack so it can't be touched after this
+        job.total_pending.fetch_sub(task.end-task.start, std::memory_order_acq_rel);
+    }
+
+    // thread waits for new jobs and helps to run them
+    void RunnerThread(const size_t thread_index) {
+        uint64_t epoch = job_epoch.load(std::memory_order_acquire);
+        int total_spins = 0;
+        auto spin_start = std::chrono::steady_clock::now();
+        while (is_running.load(std::memory_order_relaxed)) {
+            if (RunNextTask(thread_index)) {
+                total_spins = 0;
+                continue;
+            }
+
+            if (total_spins == 0) {
+                spin_start = std::chrono::steady_clock::now();
+            }
+            total_spins++;
+            if (total_spins < TOTAL_SPINS_BEFORE_YIELD) {
+                work_stealing_pause();
+            } else {
+                std::this_thread::yield();
+            }
+            if ((total_spins % TOTAL_SPINS_PER_CLOCK_CHECK) != 0) {
+                continue;
+            }
+            const auto spin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-spin_start).count();
+            if (spin_ns < spin_duration_ns.load(std::memory_order_relaxed)) {
+                continue;
+            }
+
+            // sleep until a new job is posted since the last time we looked for work
+            auto lock = std::unique_lock(mutex_sleep);
+            total_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            cv_wake.wait(lock, [this, epoch] {
+                return job_epoch.load(std::memory_order_seq_cst) != epoch || !is_running;
+            });
+            total_sleeping.fetch_sub(1, std::memory_order_seq_cst);
+            epoch = job_epoch.load(std::memory_order_acquire);
+            total_spins = 0;
+        }
+    }
+};